@@ -13,7 +13,7 @@
 template <typename T>
 class BlockingQueue {
  public:
-   BlockingQueue() { }
+   BlockingQueue() : running_(true) { }
 
    void PushBack(T obj) {
      std::unique_lock<std::mutex> lock(mutex_);
@@ -74,8 +74,7 @@ class BlockingQueue {
    // this method will block if the queue is empty
    bool HasNext(int wait_time = -1) {
      std::unique_lock<std::mutex> lock(mutex_);
-     running_ = true;
-     if (deque_.size() == 0 && wait_time != 0) {
+     if (deque_.size() == 0 && wait_time != 0 && running_) {
        if (wait_time > 0) {
          cond_.wait_for(lock, std::chrono::milliseconds(wait_time));
        } else {
@@ -86,6 +85,21 @@ class BlockingQueue {
      return deque_.size() > 0;
    }
 
+   // blocks until the queue has an element and moves it to |obj|, returns
+   // false once the queue has quit and is empty. unlike Front() and
+   // PopFront(), it can be called by several consumers at once
+   bool TakeFront(T *obj) {
+     std::unique_lock<std::mutex> lock(mutex_);
+     cond_.wait(lock, [this]{ return !running_ || !deque_.empty(); });
+     if (deque_.empty()) {
+       return false;
+     }
+
+     *obj = std::move(deque_.front());
+     deque_.pop_front();
+     return true;
+   }
+
    const T &Front() const {
      std::unique_lock<std::mutex> lock(mutex_);
      const T &obj = deque_.front();
@@ -114,11 +128,16 @@ class BlockingQueue {
      deque_.clear();
    }
 
+   bool IsRunning() {
+     std::unique_lock<std::mutex> lock(mutex_);
+     return running_;
+   }
+
    void QuitBlocking() {
      std::unique_lock<std::mutex> lock(mutex_);
      running_ = false;
      lock.unlock();
-     cond_.notify_one();
+     cond_.notify_all();
    }
 
    const std::deque<T> &GetDeque() const {
@@ -0,0 +1,105 @@
+/*******************************************************************************
+**          File: crc32.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-16 Fri 11:52 PM
+**   Description: CRC-32C (Castagnoli), uses the SSE4.2 crc32 instruction
+**                when the CPU supports it
+*******************************************************************************/
+#include "crc32.h"
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define CRC32_HAVE_SSE42_PATH 1
+#endif
+
+namespace crc32 {
+
+namespace {
+  const uint32_t POLY = 0x82f63b78; // reversed Castagnoli polynomial
+
+  struct Table {
+    uint32_t t[8][256];
+
+    Table() {
+      for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+          c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+        }
+        t[0][i] = c;
+      }
+      for (uint32_t i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k) {
+          t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+        }
+      }
+    }
+  };
+
+  // slicing-by-8, consumes 8 bytes per iteration
+  uint32_t CalcSoftware(const unsigned char *p, std::size_t len,
+      uint32_t crc) {
+    static const Table table;
+    const uint32_t (*t)[256] = table.t;
+
+    while (len >= 8) {
+      uint32_t lo = (p[0] | (p[1] << 8) | (p[2] << 16) |
+          ((uint32_t)p[3] << 24)) ^ crc;
+      uint32_t hi = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+      crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+        t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+        t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+        t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+      p += 8;
+      len -= 8;
+    }
+
+    while (len-- > 0) {
+      crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+  }
+
+#ifdef CRC32_HAVE_SSE42_PATH
+  __attribute__((target("sse4.2")))
+  uint32_t CalcSse42(const unsigned char *p, std::size_t len, uint32_t crc) {
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+      uint64_t v;
+      std::memcpy(&v, p, 8);
+      crc64 = _mm_crc32_u64(crc64, v);
+      p += 8;
+      len -= 8;
+    }
+
+    uint32_t crc32 = static_cast<uint32_t>(crc64);
+    while (len-- > 0) {
+      crc32 = _mm_crc32_u8(crc32, *p++);
+    }
+
+    return crc32;
+  }
+
+  bool HasSse42() {
+    static const bool has_sse42 = __builtin_cpu_supports("sse4.2");
+    return has_sse42;
+  }
+#endif
+};
+
+uint32_t calc(const void *src, std::size_t len, uint32_t crc) {
+  const unsigned char *p = static_cast<const unsigned char *>(src);
+  crc = ~crc;
+
+#ifdef CRC32_HAVE_SSE42_PATH
+  if (HasSse42()) {
+    return ~CalcSse42(p, len, crc);
+  }
+#endif
+
+  return ~CalcSoftware(p, len, crc);
+}
+
+} // namespace crc32
@@ -0,0 +1,25 @@
+/*******************************************************************************
+**          File: crc32.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-16 Fri 11:52 PM
+**   Description: CRC-32C (Castagnoli), uses the SSE4.2 crc32 instruction
+**                when the CPU supports it
+*******************************************************************************/
+#ifndef CRC32_H_
+#define CRC32_H_
+#include <cstddef>
+#include <cstdint>
+
+namespace crc32 {
+
+  /**
+   @param src points to the data to checksum.
+   @param len the number of bytes to checksum.
+   @param crc the checksum of the preceding data when checksumming in pieces,
+   0 to start a new one.
+   */
+  uint32_t calc(const void *src, std::size_t len, uint32_t crc = 0);
+
+} // namespace crc32
+
+#endif /* end of include guard: CRC32_H_ */
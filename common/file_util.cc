@@ -9,6 +9,7 @@
 #include <sys/stat.h> /* for lstat */
 #include <cerrno>
 #include <cstdio>
+#include <cstring>
 #include "log/log.h"
 
 std::string FileUtil::ReadFileAsString(const std::string &path) {
@@ -0,0 +1,318 @@
+/*******************************************************************************
+**          File: io_engine.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:39 AM
+**   Description: asynchronous reads and writes of file descriptors, with
+**                io_uring on Linux and a thread pool elsewhere
+*******************************************************************************/
+#include "io_engine.h"
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "log/log.h"
+
+namespace {
+  // io_uring takes 32-bit lengths, a longer operation is cut short
+  const std::size_t MAX_OP_LEN = 1UL << 30;
+
+#ifdef __linux__
+  // raw system calls, liburing is not needed for the few used here
+  int IoUringSetup(unsigned entries, struct io_uring_params *params) {
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+  }
+
+  int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+      unsigned flags) {
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+          min_complete, flags, nullptr, 0));
+  }
+#endif
+};
+
+IoEngine::IoEngine(unsigned queue_depth, int thread_count,
+    bool use_io_uring) {
+#ifdef __linux__
+  ring_fd_ = -1;
+  sq_ring_ = nullptr;
+  cq_ring_ = nullptr;
+  sqes_ = nullptr;
+  in_flight_ = 0;
+  error_ = 0;
+
+  if (use_io_uring && SetUpRing(queue_depth > 0 ? queue_depth : 1)) {
+    completion_thread_ = std::thread(&IoEngine::RunCompletions, this);
+    return;
+  }
+#else
+  (void)queue_depth;
+  (void)use_io_uring;
+#endif
+
+  pool_.reset(new ThreadPool(thread_count > 0 ? thread_count : 1));
+}
+
+IoEngine::~IoEngine() {
+#ifdef __linux__
+  if (!pool_) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this]{ return in_flight_ == 0; });
+
+    // a NOP without an operation stops the completion thread, which quits
+    // by itself once nothing is in flight if it could not wait any more
+    if (error_ == 0 && PushSqe(lock, nullptr) != 0) {
+      LOG_E("IoEngine", "failed to stop the completion thread");
+    }
+    lock.unlock();
+    completion_thread_.join();
+
+    TearDownRing();
+  }
+#endif
+}
+
+bool IoEngine::UsesIoUring() const {
+  return !pool_;
+}
+
+void IoEngine::Read(int fd, void *buf, std::size_t len, long offset,
+    Callback &&callback) {
+  Submit(new Op{ false, fd, buf, len < MAX_OP_LEN ? len : MAX_OP_LEN, offset,
+      std::move(callback) });
+}
+
+void IoEngine::Write(int fd, const void *buf, std::size_t len, long offset,
+    Callback &&callback) {
+  Submit(new Op{ true, fd, const_cast<void *>(buf),
+      len < MAX_OP_LEN ? len : MAX_OP_LEN, offset, std::move(callback) });
+}
+
+void IoEngine::Submit(Op *op) {
+  if (pool_) {
+    pool_->Run([this, op]{ RunSync(op); });
+    return;
+  }
+
+#ifdef __linux__
+  std::unique_lock<std::mutex> lock(mutex_);
+  // a callback submitting another operation must not wait for itself, the
+  // completion ring has room for twice the queue depth
+  if (std::this_thread::get_id() != completion_thread_.get_id()) {
+    cond_.wait(lock, [this]{ return in_flight_ < sq_entries_; });
+  }
+  int error = error_;
+  if (error == 0) {
+    ++in_flight_;
+    error = PushSqe(lock, op);
+    if (error == 0) {
+      return;
+    }
+    --in_flight_;
+    cond_.notify_all();
+  }
+
+  // the callback may submit again, so it runs unlocked
+  lock.unlock();
+  op->callback(error);
+  delete op;
+#endif
+}
+
+void IoEngine::RunSync(Op *op) {
+  ssize_t result;
+  do {
+    result = op->write ? ::pwrite(op->fd, op->buf, op->len, op->offset) :
+      ::pread(op->fd, op->buf, op->len, op->offset);
+  } while (result < 0 && errno == EINTR);
+
+  op->callback(result < 0 ? -errno : result);
+  delete op;
+}
+
+#ifdef __linux__
+bool IoEngine::SetUpRing(unsigned queue_depth) {
+  struct io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  ring_fd_ = IoUringSetup(queue_depth, &params);
+  if (ring_fd_ < 0) {
+    LOG_W("IoEngine", "io_uring is unavailable: %s", strerror(errno));
+    return false;
+  }
+
+  // IORING_OP_READ and IORING_OP_WRITE came along with RW_CUR_POS in 5.6,
+  // and completions must not be dropped when the ring overflows
+  if (!(params.features & IORING_FEAT_RW_CUR_POS) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    LOG_W("IoEngine", "io_uring of this kernel is too old");
+    TearDownRing();
+    return false;
+  }
+
+  sq_entries_ = params.sq_entries;
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap && cq_ring_size_ > sq_ring_size_) {
+    sq_ring_size_ = cq_ring_size_;
+  }
+
+  sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+  } else if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+    }
+  }
+  sqes_ = ::mmap(nullptr, sq_entries_ * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+      IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    sqes_ = nullptr;
+  }
+
+  if (!sq_ring_ || !cq_ring_ || !sqes_) {
+    LOG_W("IoEngine", "failed to map the io_uring rings: %s",
+        strerror(errno));
+    TearDownRing();
+    return false;
+  }
+
+  char *sq = static_cast<char *>(sq_ring_);
+  sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+  char *cq = static_cast<char *>(cq_ring_);
+  cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes_ = cq + params.cq_off.cqes;
+
+  LOG_V("IoEngine", "io_uring set up, %u entries", sq_entries_);
+  return true;
+}
+
+void IoEngine::TearDownRing() {
+  if (sqes_) {
+    ::munmap(sqes_, sq_entries_ * sizeof(struct io_uring_sqe));
+    sqes_ = nullptr;
+  }
+  if (cq_ring_ && cq_ring_ != sq_ring_) {
+    ::munmap(cq_ring_, cq_ring_size_);
+  }
+  cq_ring_ = nullptr;
+  if (sq_ring_) {
+    ::munmap(sq_ring_, sq_ring_size_);
+    sq_ring_ = nullptr;
+  }
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+  }
+}
+
+// called with |lock| of |mutex_| held, a null |op| is a NOP. every entry
+// is submitted right away, so the kernel has consumed it before the next
+// one goes in and the submission ring never fills up. an entry the kernel
+// does not take is taken back, and if the kernel is short of resources,
+// or the completion ring is full, it is pushed again after a completion
+// or a millisecond, with |lock| released meanwhile. returns 0, or -errno
+// if the entry could not be submitted
+int IoEngine::PushSqe(std::unique_lock<std::mutex> &lock, Op *op) {
+  while (true) {
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe *sqe = static_cast<struct io_uring_sqe *>(sqes_) +
+      index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    if (op) {
+      sqe->opcode = op->write ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe->fd = op->fd;
+      sqe->addr = reinterpret_cast<unsigned long>(op->buf);
+      sqe->len = op->len;
+      sqe->off = op->offset;
+    } else {
+      sqe->opcode = IORING_OP_NOP;
+    }
+    sqe->user_data = reinterpret_cast<unsigned long>(op);
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+    if (IoUringEnter(ring_fd_, 1, 0, 0) >= 0) {
+      return 0;
+    }
+
+    int error = errno;
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+    if (error == EAGAIN || error == EBUSY) {
+      cond_.wait_for(lock, std::chrono::milliseconds(1));
+    } else if (error != EINTR) {
+      LOG_E("IoEngine", "io_uring_enter failed: %s", strerror(error));
+      return -error;
+    }
+  }
+}
+
+// |in_flight_| drops only after the callback has run, so the destructor
+// does not stop the thread while a callback may still submit
+void IoEngine::RunCompletions() {
+  while (true) {
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+      if (error_ == 0) {
+        if (IoUringEnter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 &&
+            errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+          int error = errno;
+          LOG_E("IoEngine", "waiting for completions failed: %s",
+              strerror(error));
+          std::lock_guard<std::mutex> lock(mutex_);
+          error_ = -error;
+        }
+        continue;
+      }
+
+      // the ring cannot be waited on, but the kernel still owns the
+      // buffers of the operations it has taken, so their completions are
+      // polled for, and the thread quits once there are none left
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (in_flight_ == 0) {
+          break;
+        }
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    struct io_uring_cqe *cqe = static_cast<struct io_uring_cqe *>(cqes_) +
+      (head & *cq_mask_);
+    Op *op = reinterpret_cast<Op *>(cqe->user_data);
+    long result = cqe->res;
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+    if (!op) {
+      break;
+    }
+
+    op->callback(result);
+    delete op;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_flight_;
+    cond_.notify_all();
+  }
+}
+#endif
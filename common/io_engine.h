@@ -0,0 +1,100 @@
+/*******************************************************************************
+**          File: io_engine.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:39 AM
+**   Description: asynchronous reads and writes of file descriptors, with
+**                io_uring on Linux and a thread pool elsewhere
+*******************************************************************************/
+#ifndef IO_ENGINE_H_
+#define IO_ENGINE_H_
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include "common/thread_pool.h"
+
+// Read() and Write() return at once, |callback| is called with the number
+// of bytes read or written, which may be short, or -errno once the
+// operation completes. the callbacks run on a thread of the engine, they
+// may submit more operations but should not block for long.
+//
+// io_uring is used if |use_io_uring| and the kernel allows it, the
+// operations are then submitted as they come and a single thread reaps
+// their completions, at most |queue_depth| of them in flight. otherwise
+// |thread_count| threads do them with pread(2) and pwrite(2). the
+// destructor waits for the operations in flight. only reads and writes of
+// open descriptors are done here, opening, renaming, deleting and syncing
+// files are left to the callers.
+class IoEngine {
+ public:
+   using Callback = std::function<void(long result)>;
+
+   IoEngine(unsigned queue_depth, int thread_count, bool use_io_uring = true);
+   ~IoEngine();
+
+   IoEngine(const IoEngine &) = delete;
+   IoEngine &operator=(const IoEngine &) = delete;
+
+ public:
+   bool UsesIoUring() const;
+   void Read(int fd, void *buf, std::size_t len, long offset,
+       Callback &&callback);
+   void Write(int fd, const void *buf, std::size_t len, long offset,
+       Callback &&callback);
+
+ private:
+   struct Op {
+     bool write;
+     int fd;
+     void *buf;
+     std::size_t len;
+     long offset;
+     Callback callback;
+   };
+
+   void Submit(Op *op);
+   void RunSync(Op *op);
+#ifdef __linux__
+   bool SetUpRing(unsigned queue_depth);
+   void TearDownRing();
+   int PushSqe(std::unique_lock<std::mutex> &lock, Op *op);
+   void RunCompletions();
+#endif
+
+ private:
+   // the pool of the fallback, null with io_uring
+   std::unique_ptr<ThreadPool> pool_;
+
+#ifdef __linux__
+   int ring_fd_;
+   void *sq_ring_;
+   std::size_t sq_ring_size_;
+   void *cq_ring_;
+   std::size_t cq_ring_size_;
+   void *sqes_;
+   unsigned sq_entries_;
+
+   // pointers into the rings, see io_uring_setup(2)
+   unsigned *sq_head_;
+   unsigned *sq_tail_;
+   unsigned *sq_mask_;
+   unsigned *sq_array_;
+   unsigned *cq_head_;
+   unsigned *cq_tail_;
+   unsigned *cq_mask_;
+   void *cqes_;
+
+   // guards submission, |in_flight_| and |error_|
+   std::mutex mutex_;
+   std::condition_variable cond_;
+   unsigned in_flight_;
+   // -errno of the failure to wait for completions, operations submitted
+   // after it fail with it
+   int error_;
+   std::thread completion_thread_;
+#endif
+};
+
+#endif /* end of include guard: IO_ENGINE_H_ */
@@ -0,0 +1,103 @@
+/*******************************************************************************
+**          File: mapped_file.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 12:05 AM
+**   Description: a read-only memory mapping of a file
+*******************************************************************************/
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#include "log/log.h"
+
+MappedFile::MappedFile() :
+  is_open_(false), data_(nullptr), size_(0), page_offset_(0) {
+}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  bool mapped = Map(fd);
+
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+
+  if (!mapped) {
+    LOG_E("MappedFile", "failed to map %s", path.c_str());
+  }
+  return mapped;
+}
+
+bool MappedFile::Map(int fd) {
+  Close();
+
+  struct stat stat_buf;
+  if (::fstat(fd, &stat_buf) != 0) {
+    LOG_E("MappedFile", "failed to stat fd %d: %s", fd, strerror(errno));
+    return false;
+  }
+
+  size_ = stat_buf.st_size;
+  if (size_ > 0) {
+    void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+      LOG_E("MappedFile", "failed to mmap fd %d: %s", fd, strerror(errno));
+      size_ = 0;
+      return false;
+    }
+    data_ = static_cast<char *>(addr);
+  }
+
+  is_open_ = true;
+  return true;
+}
+
+bool MappedFile::Map(int fd, long offset, std::size_t length) {
+  Close();
+
+  if (length > 0) {
+    long page_size = ::sysconf(_SC_PAGESIZE);
+    long page_offset = offset % page_size;
+    void *addr = ::mmap(nullptr, length + page_offset, PROT_READ, MAP_SHARED,
+        fd, offset - page_offset);
+    if (addr == MAP_FAILED) {
+      LOG_E("MappedFile", "failed to mmap fd %d: %s", fd, strerror(errno));
+      return false;
+    }
+    data_ = static_cast<char *>(addr) + page_offset;
+    size_ = length;
+    page_offset_ = page_offset;
+  }
+
+  is_open_ = true;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    ::munmap(data_ - page_offset_, size_ + page_offset_);
+  }
+
+  is_open_ = false;
+  data_ = nullptr;
+  size_ = 0;
+  page_offset_ = 0;
+}
+
+void MappedFile::AdviseSequential() {
+  if (data_) {
+    ::madvise(data_, size_, MADV_SEQUENTIAL);
+  }
+}
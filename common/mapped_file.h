@@ -0,0 +1,56 @@
+/*******************************************************************************
+**          File: mapped_file.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 12:05 AM
+**   Description: a read-only memory mapping of a file
+*******************************************************************************/
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+#include <string>
+#include <cstddef>
+
+class MappedFile {
+ public:
+   MappedFile();
+   ~MappedFile();
+
+   MappedFile(const MappedFile &) = delete;
+   MappedFile &operator=(const MappedFile &) = delete;
+
+ public:
+   // maps the whole file, an empty file is opened with a null Data()
+   bool Open(const std::string &path);
+   // same as above for an opened file, |fd| can be closed afterwards
+   bool Map(int fd);
+   // maps |length| bytes of an opened file from |offset|, which needs not be
+   // aligned to pages
+   bool Map(int fd, long offset, std::size_t length);
+   void Close();
+   // tells the kernel the mapping will be read sequentially
+   void AdviseSequential();
+
+   inline bool IsOpen() const;
+   inline const char *Data() const;
+   inline std::size_t Size() const;
+
+ private:
+   bool is_open_;
+   char *data_;
+   std::size_t size_;
+   // bytes mapped in front of |data_| to align the mapping to pages
+   std::size_t page_offset_;
+};
+
+bool MappedFile::IsOpen() const {
+  return is_open_;
+}
+
+const char *MappedFile::Data() const {
+  return data_;
+}
+
+std::size_t MappedFile::Size() const {
+  return size_;
+}
+
+#endif /* end of include guard: MAPPED_FILE_H_ */
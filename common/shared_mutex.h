@@ -0,0 +1,65 @@
+/*******************************************************************************
+**          File: shared_mutex.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 09:10 PM
+**   Description: a readers-writer lock for C++11, which has no
+**                std::shared_mutex
+*******************************************************************************/
+#ifndef SHARED_MUTEX_H_
+#define SHARED_MUTEX_H_
+#include <pthread.h>
+
+// lock()/unlock() take the lock exclusively, so std::lock_guard and
+// std::unique_lock work with it, lock_shared()/unlock_shared() take it
+// along with other readers, see SharedLock
+class SharedMutex {
+ public:
+   SharedMutex() {
+     pthread_rwlock_init(&rwlock_, nullptr);
+   }
+
+   ~SharedMutex() {
+     pthread_rwlock_destroy(&rwlock_);
+   }
+
+   SharedMutex(const SharedMutex &) = delete;
+   SharedMutex &operator=(const SharedMutex &) = delete;
+
+   void lock() {
+     pthread_rwlock_wrlock(&rwlock_);
+   }
+
+   void unlock() {
+     pthread_rwlock_unlock(&rwlock_);
+   }
+
+   void lock_shared() {
+     pthread_rwlock_rdlock(&rwlock_);
+   }
+
+   void unlock_shared() {
+     pthread_rwlock_unlock(&rwlock_);
+   }
+
+ private:
+   pthread_rwlock_t rwlock_;
+};
+
+class SharedLock {
+ public:
+   explicit SharedLock(SharedMutex &mutex) : mutex_(mutex) {
+     mutex_.lock_shared();
+   }
+
+   ~SharedLock() {
+     mutex_.unlock_shared();
+   }
+
+   SharedLock(const SharedLock &) = delete;
+   SharedLock &operator=(const SharedLock &) = delete;
+
+ private:
+   SharedMutex &mutex_;
+};
+
+#endif /* end of include guard: SHARED_MUTEX_H_ */
@@ -0,0 +1,107 @@
+/*******************************************************************************
+**          File: thread_pool.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:34 AM
+**   Description: a fixed number of threads running tasks off a
+**                BlockingQueue
+*******************************************************************************/
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "common/blocking_queue.h"
+
+// the tasks queued when the pool is destroyed are still run
+class ThreadPool {
+ public:
+   explicit ThreadPool(int thread_count) {
+     for (int i = 0; i < thread_count; ++i) {
+       workers_.emplace_back([this]{
+         std::function<void()> task;
+         while (tasks_.TakeFront(&task)) {
+           task();
+         }
+       });
+     }
+   }
+
+   ~ThreadPool() {
+     tasks_.QuitBlocking();
+     for (auto &worker : workers_) {
+       worker.join();
+     }
+   }
+
+   ThreadPool(const ThreadPool &) = delete;
+   ThreadPool &operator=(const ThreadPool &) = delete;
+
+   int ThreadCount() const {
+     return workers_.size();
+   }
+
+   void Run(std::function<void()> &&task) {
+     tasks_.ForwardPushBack(std::move(task));
+   }
+
+   // calls |fun| with every index in [0, count) on the pool threads and the
+   // calling thread, and returns once all the calls have returned. the pool
+   // threads busy with other tasks join in when they get to it, if ever
+   void ParallelFor(std::size_t count,
+       const std::function<void(std::size_t)> &fun) {
+     if (workers_.empty() || count < 2) {
+       for (std::size_t i = 0; i < count; ++i) {
+         fun(i);
+       }
+       return;
+     }
+
+     struct Batch {
+       std::atomic<std::size_t> next;
+       std::size_t done;
+       std::mutex mutex;
+       std::condition_variable cond;
+
+       Batch() : next(0), done(0) { }
+     };
+     std::shared_ptr<Batch> batch(std::make_shared<Batch>());
+
+     // |fun| is only called for indices taken before the batch is done, the
+     // caller is still waiting then
+     auto run = [batch, count, &fun]{
+       std::size_t ran = 0;
+       std::size_t i;
+       while ((i = batch->next++) < count) {
+         fun(i);
+         ++ran;
+       }
+       if (ran > 0) {
+         std::lock_guard<std::mutex> lock(batch->mutex);
+         batch->done += ran;
+         if (batch->done == count) {
+           batch->cond.notify_all();
+         }
+       }
+     };
+
+     std::size_t helpers = workers_.size() < count - 1 ?
+       workers_.size() : count - 1;
+     for (std::size_t i = 0; i < helpers; ++i) {
+       Run(run);
+     }
+     run();
+
+     std::unique_lock<std::mutex> lock(batch->mutex);
+     batch->cond.wait(lock, [batch, count]{ return batch->done == count; });
+   }
+
+ private:
+   BlockingQueue<std::function<void()>> tasks_;
+   std::vector<std::thread> workers_;
+};
+
+#endif /* end of include guard: THREAD_POOL_H_ */
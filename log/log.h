@@ -3,6 +3,8 @@
 #include <string>
 #include <stdarg.h>    // for va_list, va_start and va_end
 #include <sys/time.h>
+#include <ctime>
+#include <cstdio>
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -0,0 +1,226 @@
+/*******************************************************************************
+**          File: clock_memory_cache.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 09:10 PM
+**   Description: a TypedMemoryCache evicting with CLOCK, its hits only take
+**                a shared lock
+*******************************************************************************/
+#ifndef CLOCK_MEMORY_CACHE_H_
+#define CLOCK_MEMORY_CACHE_H_
+#include <atomic>
+#include <mutex>
+#include "lru/typed_memory_cache.h"
+#include "common/shared_mutex.h"
+
+namespace lru {
+
+// the same interface as TypedMemoryCache, but a hit does not move the entry
+// to the front of the list, it sets the reference bit of the entry instead,
+// with a relaxed atomic store, and leaves the list alone. Get() and Visit()
+// therefore take the lock shared and hits run in parallel, Put() and
+// Remove() still take it exclusively.
+//
+// entries are evicted from the back of the list, an entry whose bit is set
+// has the bit cleared and goes to the front instead, i.e. the second chance
+// variant of CLOCK, which approximates LRU. hits between two passes of the
+// clock hand count the same as a single one, so the order in which recently
+// read entries are evicted is arbitrary, see bench_memory_cache for how far
+// that is from LRU.
+template <typename K, typename V, typename SizeFn = UnitSize,
+         typename Hash = DefaultKeyHash<K>>
+class ClockMemoryCache {
+ public:
+   ClockMemoryCache(long max_cache_size, long max_item_count,
+       const SizeFn &size_fn = SizeFn(),
+       float eviction_high_watermark = 1.0f,
+       float eviction_low_watermark = 0.95f) :
+     max_cache_size_(max_cache_size),
+     max_item_count_(max_item_count),
+     cur_cache_size_(0),
+     eviction_high_watermark_(eviction_high_watermark),
+     eviction_low_watermark_(eviction_low_watermark),
+     evicting_(false),
+     size_fn_(size_fn) { }
+
+   ClockMemoryCache(const ClockMemoryCache &) = delete;
+   ClockMemoryCache &operator=(const ClockMemoryCache &) = delete;
+
+ public:
+   template <typename KeyLike>
+   bool Get(const KeyLike &key, V *value) {
+     return Visit(key, [value](const V &v) { *value = v; });
+   }
+
+   // |fun| may be called on several threads at once, for the same value too
+   template <typename KeyLike, typename Fun>
+   bool Visit(const KeyLike &key, Fun &&fun) {
+     SharedLock lock(mutex_);
+
+     const EntryIndex &entries = entries_;
+     Handle handle = entries.Find(key);
+     if (handle == EntryIndex::INVALID_HANDLE) {
+       return false;
+     }
+
+     const Slot &slot = entries.ValueOf(handle);
+     // only written the first time, so hot entries do not bounce their
+     // cache line between the readers
+     if (!slot.referenced.load(std::memory_order_relaxed)) {
+       slot.referenced.store(true, std::memory_order_relaxed);
+     }
+     fun(slot.value);
+     return true;
+   }
+
+   // the old value of |key| is destroyed if exists
+   void Put(K key, V value) {
+     std::lock_guard<SharedMutex> lock(mutex_);
+
+     long size = size_fn_(key, value);
+
+     Handle handle = entries_.Find(key);
+     if (handle != EntryIndex::INVALID_HANDLE) {
+       Slot &slot = entries_.ValueOf(handle);
+       cur_cache_size_ -= size_fn_(key, slot.value);
+       slot.value = std::move(value);
+       slot.referenced.store(true, std::memory_order_relaxed);
+
+     } else {
+       entries_.PushFront(std::move(key), Slot(std::move(value)));
+     }
+
+     cur_cache_size_ += size;
+
+     EvictIfNeeded();
+   }
+
+   template <typename KeyLike>
+   bool Remove(const KeyLike &key) {
+     std::lock_guard<SharedMutex> lock(mutex_);
+
+     Handle handle = entries_.Find(key);
+     if (handle == EntryIndex::INVALID_HANDLE) {
+       return false;
+     }
+
+     RemoveInternal(handle);
+     return true;
+   }
+
+   void EvictAll() {
+     std::lock_guard<SharedMutex> lock(mutex_);
+     entries_.Clear();
+     cur_cache_size_ = 0;
+     evicting_ = false;
+   }
+
+   long ItemCount() const {
+     SharedLock lock(mutex_);
+     return entries_.Size();
+   }
+
+   long MaxItemCount() const {
+     return max_item_count_;
+   }
+
+   long CurrentCacheSize() const {
+     SharedLock lock(mutex_);
+     return cur_cache_size_;
+   }
+
+   long MaxCacheSize() const {
+     return max_cache_size_;
+   }
+
+ private:
+   // std::atomic can be neither copied nor moved, which the slab of
+   // LruIndex needs, the copies are only made under the exclusive lock
+   struct ReferenceBit : std::atomic<bool> {
+     ReferenceBit() : std::atomic<bool>(false) { }
+     ReferenceBit(const ReferenceBit &other) :
+       std::atomic<bool>(other.load(std::memory_order_relaxed)) { }
+     ReferenceBit &operator=(const ReferenceBit &other) {
+       store(other.load(std::memory_order_relaxed), std::memory_order_relaxed);
+       return *this;
+     }
+   };
+
+   struct Slot {
+     Slot() : value() { }
+     explicit Slot(V &&v) : value(std::move(v)) { }
+
+     V value;
+     mutable ReferenceBit referenced;
+   };
+
+   using EntryIndex = LruIndex<K, Slot, Hash>;
+   using Handle = typename EntryIndex::Handle;
+
+   // entries a Put() looks at at most between the watermarks
+   static const std::size_t EVICTION_BATCH_SIZE = 16;
+
+   // same as TypedMemoryCache, between the watermarks a Put() evicts a
+   // small batch, which counts the entries given a second chance as well.
+   // every entry moved to the front has its bit cleared, so staying within
+   // the limits takes one pass over the list at most
+   void EvictIfNeeded() {
+     if (!evicting_) {
+       if (cur_cache_size_ <= max_cache_size_ * eviction_high_watermark_ &&
+           static_cast<long>(entries_.Size()) <=
+           max_item_count_ * eviction_high_watermark_) {
+         return;
+       }
+       evicting_ = true;
+     }
+
+     std::size_t visited = 0;
+     while (!entries_.Empty() && (cur_cache_size_ > max_cache_size_ ||
+           static_cast<long>(entries_.Size()) > max_item_count_ ||
+           (visited < EVICTION_BATCH_SIZE && IsOverTarget()))) {
+       Handle handle = entries_.Back();
+       Slot &slot = entries_.ValueOf(handle);
+       if (slot.referenced.load(std::memory_order_relaxed)) {
+         slot.referenced.store(false, std::memory_order_relaxed);
+         entries_.MoveToFront(handle);
+       } else {
+         RemoveInternal(handle);
+       }
+       ++visited;
+     }
+
+     if (!IsOverTarget()) {
+       evicting_ = false;
+     }
+   }
+
+   bool IsOverTarget() const {
+     return cur_cache_size_ > max_cache_size_ * eviction_low_watermark_ ||
+       static_cast<long>(entries_.Size()) >
+       max_item_count_ * eviction_low_watermark_;
+   }
+
+   void RemoveInternal(Handle handle) {
+     cur_cache_size_ -= size_fn_(entries_.KeyOf(handle),
+         entries_.ValueOf(handle).value);
+     entries_.Erase(handle);
+   }
+
+ private:
+   // the hand of the clock is the back of the list
+   EntryIndex entries_;
+
+   long max_cache_size_;
+   long max_item_count_;
+   long cur_cache_size_;
+   float eviction_high_watermark_;
+   float eviction_low_watermark_;
+   // set from crossing the high watermark to getting below the low one
+   bool evicting_;
+   SizeFn size_fn_;
+
+   mutable SharedMutex mutex_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: CLOCK_MEMORY_CACHE_H_ */
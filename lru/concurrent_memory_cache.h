@@ -0,0 +1,150 @@
+/*******************************************************************************
+**          File: concurrent_memory_cache.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 08:05 PM
+**   Description: a TypedMemoryCache split into independently locked segments
+*******************************************************************************/
+#ifndef CONCURRENT_MEMORY_CACHE_H_
+#define CONCURRENT_MEMORY_CACHE_H_
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "lru/typed_memory_cache.h"
+#include "lru/clock_memory_cache.h"
+
+namespace lru {
+
+// keys are spread over |segment_count| segments by their hash, each segment
+// is a TypedMemoryCache with a lock and an LRU list of its own, so threads
+// working on different segments never wait for each other. the limits are
+// split evenly among the segments, which evict on their own once they
+// exceed their share, so the least recently used entry of the whole cache
+// is not necessarily the first to go. there are fewer segments than asked
+// for if the limits are too small to give each of them a share.
+//
+// |SegmentCache| is the cache of a segment, TypedMemoryCache for LRU or
+// ClockMemoryCache for CLOCK, see ConcurrentClockMemoryCache
+template <typename K, typename V, typename SizeFn = UnitSize,
+         typename Hash = DefaultKeyHash<K>,
+         template <typename, typename, typename, typename> class SegmentCache =
+           TypedMemoryCache>
+class ConcurrentMemoryCache {
+ public:
+   ConcurrentMemoryCache(long max_cache_size, long max_item_count,
+       int segment_count = 16, const SizeFn &size_fn = SizeFn(),
+       const Hash &hash = Hash()) :
+     max_cache_size_(max_cache_size),
+     max_item_count_(max_item_count),
+     hash_(hash) {
+     // every segment gets at least one item and one unit of size, or it
+     // would drop everything put in it
+     if (segment_count > max_item_count) {
+       segment_count = max_item_count;
+     }
+     if (segment_count > max_cache_size) {
+       segment_count = max_cache_size;
+     }
+     if (segment_count < 1) {
+       segment_count = 1;
+     }
+
+     // the remainders go to the first segments, so the budgets add up to
+     // the limits exactly
+     for (int i = 0; i < segment_count; ++i) {
+       long segment_size = max_cache_size / segment_count +
+         (i < max_cache_size % segment_count ? 1 : 0);
+       long segment_items = max_item_count / segment_count +
+         (i < max_item_count % segment_count ? 1 : 0);
+       segments_.emplace_back(new Segment(segment_size, segment_items,
+             size_fn));
+     }
+   }
+
+   ConcurrentMemoryCache(const ConcurrentMemoryCache &) = delete;
+   ConcurrentMemoryCache &operator=(const ConcurrentMemoryCache &) = delete;
+
+ public:
+   template <typename KeyLike>
+   bool Get(const KeyLike &key, V *value) {
+     return SegmentOf(key).Get(key, value);
+   }
+
+   template <typename KeyLike, typename Fun>
+   bool Visit(const KeyLike &key, Fun &&fun) {
+     return SegmentOf(key).Visit(key, std::forward<Fun>(fun));
+   }
+
+   void Put(K key, V value) {
+     Segment &segment = SegmentOf(key);
+     segment.Put(std::move(key), std::move(value));
+   }
+
+   template <typename KeyLike>
+   bool Remove(const KeyLike &key) {
+     return SegmentOf(key).Remove(key);
+   }
+
+   void EvictAll() {
+     for (auto &segment : segments_) {
+       segment->EvictAll();
+     }
+   }
+
+   // the totals are summed over the segments one after another, they are
+   // not a consistent snapshot while other threads change the cache
+   long ItemCount() const {
+     long count = 0;
+     for (auto &segment : segments_) {
+       count += segment->ItemCount();
+     }
+     return count;
+   }
+
+   long MaxItemCount() const {
+     return max_item_count_;
+   }
+
+   long CurrentCacheSize() const {
+     long size = 0;
+     for (auto &segment : segments_) {
+       size += segment->CurrentCacheSize();
+     }
+     return size;
+   }
+
+   long MaxCacheSize() const {
+     return max_cache_size_;
+   }
+
+   int SegmentCount() const {
+     return segments_.size();
+   }
+
+ private:
+   using Segment = SegmentCache<K, V, SizeFn, Hash>;
+
+   // the segments pick the hash table slot from the low bits of the hash,
+   // the segment is picked from the high bits of the mixed hash so that
+   // keys of a segment do not crowd a few slots
+   template <typename KeyLike>
+   Segment &SegmentOf(const KeyLike &key) {
+     uint64_t hash = static_cast<uint64_t>(hash_(key));
+     hash *= 0x9e3779b97f4a7c15ULL;
+     return *segments_[(hash >> 32) % segments_.size()];
+   }
+
+ private:
+   std::vector<std::unique_ptr<Segment>> segments_;
+   long max_cache_size_;
+   long max_item_count_;
+   Hash hash_;
+};
+
+template <typename K, typename V, typename SizeFn = UnitSize,
+         typename Hash = DefaultKeyHash<K>>
+using ConcurrentClockMemoryCache =
+  ConcurrentMemoryCache<K, V, SizeFn, Hash, ClockMemoryCache>;
+
+};  // namespace lru
+
+#endif /* end of include guard: CONCURRENT_MEMORY_CACHE_H_ */
@@ -5,6 +5,17 @@
 **   Description:  
 *******************************************************************************/
 #include "disk_cache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 #include "common/file_util.h"
 #include "common/sha1/sha1.h"
 #include "log/log.h"
@@ -12,184 +23,363 @@
 namespace lru {
 
 namespace {
-  const std::string MAGIC_STRING("neevek_disklru");
-  const std::string VERSION("1.0.0");
   const std::string JOURNAL_FILE("/journal");
-
-  const char ACTION_READ = 'R'; // READ
-  const char ACTION_UPDATE = 'U'; // UPDATE
-  const char ACTION_DELETE = 'D'; // DELETE
-  const char LINE_FEED = '\n';
+  const std::string SEGMENT_DIR("/segments");
+  const std::string TRASH_DIR("/trash");
 
   const int COMPACT_THRESHOLD = 2000;
-  const float RETAIN_RATIO = 0.75f;
+  // snapshot records a journal compaction writes before letting other
+  // actions of the shard run
+  const std::size_t COMPACT_CHUNK_SIZE = 1024;
+  // entries an eviction batch takes out of the index at a time, their files
+  // are deleted before the time left for the batch is checked
+  const std::size_t EVICTION_CHUNK_SIZE = 16;
+  const int MAX_SHARD_COUNT = 256;
+
+  const char HEX_DIGITS[] = "0123456789abcdef";
 
-  std::string GenSha1Key(const std::string &key) {
+  std::string Sha1KeyToHex(const std::string &sha1_key) {
     char sha1_buf[41];
-    unsigned char sha1_hash[20];
-    sha1::calc(key.c_str(), key.size(), sha1_hash);
-    sha1::toHexString(sha1_hash, sha1_buf);
+    sha1::toHexString(
+        reinterpret_cast<const unsigned char *>(sha1_key.data()), sha1_buf);
     return std::string(sha1_buf);
   }
 };
 
+DiskCache::Sha1Key::Sha1Key(const std::string &sha1_key) {
+  std::memcpy(data, sha1_key.data(), sizeof(data));
+}
+
+bool DiskCache::Sha1Key::operator==(const Sha1Key &other) const {
+  return std::memcmp(data, other.data, sizeof(data)) == 0;
+}
+
+std::size_t DiskCache::Sha1KeyHash::operator()(const Sha1Key &key) const {
+  uint32_t hash;
+  std::memcpy(&hash, key.data + 4, sizeof(hash));
+  return hash;
+}
+
 DiskCache::DiskCache(const std::string &cache_dir, int app_version, 
   long max_cache_size, long max_item_count) :
+  DiskCache(cache_dir, app_version, max_cache_size, max_item_count,
+      Options()) {
+}
+
+DiskCache::DiskCache(const std::string &cache_dir, int app_version, 
+  long max_cache_size, long max_item_count, const Options &options) :
   cache_dir_(cache_dir),
   app_version_(app_version), 
   max_item_count_(max_item_count),
   max_cache_size_(max_cache_size),
+  warm_start_(options.warm_start),
+  packed_max_size_(options.packed_max_size),
+  segment_compact_ratio_(options.segment_compact_ratio),
+  read_journal_epoch_ms_(options.read_journal_epoch_ms),
+  eviction_high_watermark_(options.eviction_high_watermark),
+  eviction_low_watermark_(options.eviction_low_watermark),
+  eviction_batch_us_(options.eviction_batch_us),
+  use_io_uring_(options.use_io_uring),
+  io_queue_depth_(options.io_queue_depth),
+  io_thread_count_(options.io_thread_count),
+  key_hasher_(options.key_hasher),
+  tmp_file_seq_(0),
   cur_cache_size_(0),
-  redundant_count_(0) {
+  cur_item_count_(0) {
 
   if (!FileUtil::DirExists(cache_dir)) {
     FileUtil::MakeDirs(cache_dir);
   }
 
-  // start the background thread
-  action_thread_ = std::thread(&DiskCache::RunQueuedActions, this);
-
-  // run the INIT procedure in the background thread
-  EnqueueAction(std::bind(&DiskCache::InitFromJournal, this));
-}
-
-DiskCache::~DiskCache() {
-  action_queue_.QuitBlocking();
-  action_thread_.join();
-}
+  // shared by all shards, files of any shard may be moved to the trash
+  file_reaper_.reset(new FileReaper(cache_dir_ + TRASH_DIR,
+        std::max(options.unlink_thread_count, 0)));
+  file_reaper_->Open();
 
-void DiskCache::InitFromJournal() {
-  std::ifstream jn_ifstream;
+  io_pool_.reset(new ThreadPool(std::max(options.io_thread_count, 0)));
 
-  std::string jn_file(cache_dir_ + JOURNAL_FILE);
-  std::string bak_jn_file(jn_file + ".bak");
-  if (FileUtil::FileExists(bak_jn_file)) {
-    std::rename(bak_jn_file.c_str(), jn_file.c_str());
+  int shard_count = options.shard_count;
+  if (shard_count < 1) {
+    shard_count = 1;
+  } else if (shard_count > MAX_SHARD_COUNT) {
+    shard_count = MAX_SHARD_COUNT;
   }
 
-  jn_ifstream.open(jn_file, std::ios::binary);
+  for (int i = 0; i < shard_count; ++i) {
+    std::unique_ptr<Shard> shard(new Shard());
+    shard->index = i;
+    shard->evictor.reset(new EntryEvictor(&shard->entries,
+          options.eviction_policy));
+
+    std::string jn_file(cache_dir_ + JOURNAL_FILE);
+    std::string seg_dir(cache_dir_ + SEGMENT_DIR);
+    if (shard_count > 1) {
+      jn_file.append(1, '.').append(std::to_string(i));
+      seg_dir.append(1, '.').append(std::to_string(i));
+    }
+    shard->journal.reset(new Journal(jn_file, app_version_,
+          key_hasher_.name, options.journal_flush));
+
+    // opened even if packing is disabled, entries packed in earlier runs
+    // are still served from their segments
+    shard->segments.reset(new SegmentStore(seg_dir, options.segment_size,
+          file_reaper_.get()));
+    shard->segments->Open();
+    shards_.push_back(std::move(shard));
+  }
 
-  std::string line;
-  if (FileUtil::FileExists(jn_file)) {
-    if (!std::getline(jn_ifstream, line) || line != MAGIC_STRING || 
-        !std::getline(jn_ifstream, line) || line != VERSION || 
-        !std::getline(jn_ifstream, line) || line != std::to_string(app_version_) ||
-        !std::getline(jn_ifstream, line) || line != "") {
-      LOG_E("lru::DiskCache", "initializing from journal failed.");
+  for (auto &shard : shards_) {
+    Shard *s = shard.get();
 
-      FileUtil::DeleteFile(jn_file);
-      CompactJournalIfNeeded(false, true);
-      return;
-    }
+    // start the background thread
+    s->action_thread = std::thread(&DiskCache::RunQueuedActions, this,
+        std::ref(*s));
 
-  } else {
-      CompactJournalIfNeeded(false, true);
-      return;
+    // run the INIT procedure in the background thread
+    EnqueueAction(*s, [this, s]{ InitFromJournal(*s); });
   }
+}
 
-  LOG_V("lru::DiskCache", "journal file exists, ready to read it");
+DiskCache::~DiskCache() {
+  // waits for the asynchronous reads and writes, which may still commit
+  // entries and enqueue actions
+  io_engine_.reset();
 
-  ReadJournalFile(jn_file, jn_ifstream);
+  for (auto &shard : shards_) {
+    shard->action_queue.QuitBlocking();
+  }
+  for (auto &shard : shards_) {
+    shard->action_thread.join();
+  }
+
+  // runs the callbacks of the commits above
+  callback_pool_.reset();
 }
 
-void DiskCache::ReadJournalFile(const std::string &jn_file, 
-    std::ifstream &jn_ifstream) {
+void DiskCache::InitFromJournal(Shard &shard) {
+  bool needs_rewrite = false;
+  bool replayed = shard.journal->Replay(
+      [this, &shard](char action, const std::string &sha1_key, long size,
+          int segment, long offset) {
+        if (action == Journal::ACTION_UPDATE) {
+          HandleRecordForUpdate(shard, sha1_key, size, segment, offset);
 
-  std::string line;
-  while (std::getline(jn_ifstream, line)) {
-    if (line.size() == 0) {
-      continue;
-    }
+        } else if (action == Journal::ACTION_MOVE) {
+          HandleRecordForMove(shard, sha1_key, segment, offset);
 
-    int first_space = line.find(' ');
-    if (first_space == std::string::npos) {
-      LOG_E("lru::DiskCache", "invalid line: %s", line.c_str());
-      continue;
-    }
+        } else if (action == Journal::ACTION_DELETE) {
+          HandleRecordForDelete(shard, sha1_key);
 
+        } else if (action == Journal::ACTION_READ) {
+          HandleRecordForRead(shard, sha1_key);
 
-    if (line[0] == ACTION_UPDATE) {
-      int second_space = line.find(' ', first_space + 1);
-      if (first_space == std::string::npos || 
-          second_space == std::string::npos) {
-        LOG_E("lru::DiskCache", "invalid line: %s", line.c_str());
+        } else if (action == Journal::ACTION_REGION) {
+          HandleRecordForRegion(shard, sha1_key,
+              static_cast<unsigned char>(size));
+        }
+      }, &needs_rewrite);
 
-        continue;
-      }
+  // a missing or outdated journal is written out afresh
+  CompactJournalIfNeeded(shard, !replayed || needs_rewrite);
 
-      std::string sha1_key(line.substr(first_space + 1, 
-            second_space - first_space - 1));
+  if (!shard.journal->IsOpen()) {
+    shard.journal->Open();
+  }
 
-      LOG_V("lru::DiskCache", "reading line: %s", line.c_str());
-      long file_size = std::stol(line.substr(second_space));
-      HandleLineForUpdate(sha1_key, file_size);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ApplyPendingOps(shard);
+    shard.segments->DeleteDeadSegments();
+    RebuildSegmentEntries(shard);
+    shard.initialized = true;
+    shard.cond.notify_all();
+  }
 
-    } else {
-      std::string sha1_key(line.substr(first_space + 1));
+  LOG_V("lru::DiskCache",
+      "LRU cache shard %d initialized. entry count=%zd, size=%ld",
+      shard.index, shard.entries.Size(), shard.cache_size);
 
-      if (line[0] == ACTION_DELETE) {
-        HandleLineForDelete(sha1_key);
+  EvictIfNeeded(shard);
+  CompactSegmentsIfNeeded(shard);
+}
 
-      } else if (line[0] == ACTION_READ) {
-        HandleLineForRead(sha1_key);
+void DiskCache::ApplyPendingOps(Shard &shard) {
+  for (auto &op : shard.pending_ops) {
+    if (op.action == Journal::ACTION_UPDATE) {
+      HandleRecordForUpdate(shard, op.sha1_key, op.size, op.segment,
+          op.offset);
+      shard.journal->Append(op.action, op.sha1_key, op.size, op.segment,
+          op.offset);
+      // pinned by the append until its bytes are counted as live
+      if (op.segment >= 0) {
+        shard.segments->Unpin(op.segment);
       }
 
+    } else if (op.action == Journal::ACTION_DELETE) {
+      // the file was deleted when the op arrived
+      HandleRecordForDelete(shard, op.sha1_key);
+      shard.journal->Append(op.action, op.sha1_key, 0);
+
+    } else {
+      EntryHandle handle = shard.entries.Find(Sha1Key(op.sha1_key));
+      if (handle == EntryIndex::INVALID_HANDLE) {
+        continue;
+      }
+      if (PromoteEntry(shard, handle)) {
+        JournalEntry(shard, SnapshotEntry{
+            Sha1Key(op.sha1_key), shard.entries.ValueOf(handle) });
+      } else {
+        shard.journal->Append(op.action, op.sha1_key, 0);
+        ++shard.redundant_count;
+      }
     }
   }
 
-  CompactJournalIfNeeded(false, false);
+  // a key that was packed during replaying may still have the file of an
+  // earlier version, which is stale unless the key ended up in a file
+  for (auto &op : shard.pending_ops) {
+    if (op.action == Journal::ACTION_UPDATE && op.segment >= 0) {
+      EntryHandle handle = shard.entries.Find(Sha1Key(op.sha1_key));
+      if (handle == EntryIndex::INVALID_HANDLE ||
+          shard.entries.ValueOf(handle).segment >= 0) {
+        file_reaper_->Dispose(GetCacheFile(op.sha1_key));
+      }
+    }
+  }
+
+  LOG_V("lru::DiskCache", "shard %d applied %zd pending ops", shard.index,
+      shard.pending_ops.size());
 
-  journal_ofstream_.open(jn_file, std::ios::binary | std::ios::app);
-  cond_.notify_all();
+  shard.pending_ops.clear();
+  shard.pending_ops.shrink_to_fit();
+}
+
+// counts the bytes of the packed entry as live and records its position,
+// the shard is locked or being initialized
+void DiskCache::AddToSegment(Shard &shard, const std::string &sha1_key,
+    int segment, long offset, long size) {
+  shard.segments->AddLive(segment, size);
+  shard.segment_entries[segment].emplace_back(Sha1Key(sha1_key), offset);
+}
+
+// replaying leaves the positions of every version of an entry behind, only
+// the current ones are kept once it is done
+void DiskCache::RebuildSegmentEntries(Shard &shard) {
+  shard.segment_entries.clear();
+  for (EntryHandle handle = shard.entries.Front();
+      handle != EntryIndex::INVALID_HANDLE;
+      handle = shard.entries.Next(handle)) {
+    const Entry &entry = shard.entries.ValueOf(handle);
+    if (entry.segment >= 0) {
+      shard.segment_entries[entry.segment].emplace_back(
+          shard.entries.KeyOf(handle), entry.offset);
+    }
+  }
+}
+
+// calls OnHit() of the evictor, and returns true if the entry has to be
+// journaled in full with JournalEntry(). that is when it moved towards the
+// back while the journal is being compacted, it may have crossed the cursor
+// and would be missing from the new journal, the read record that promotes
+// it is ignored on replaying then
+bool DiskCache::PromoteEntry(Shard &shard, EntryHandle handle) {
+  return shard.evictor->OnHit(handle) && shard.compacting_journal;
+}
 
-  LOG_V("lru::DiskCache", "LRU cached initialized. entry count=%zd, size=%ld", 
-      entry_list_.size(), cur_cache_size_); 
+// writes the records the journal compaction writes for an entry, the entry
+// is read as well, runs on |action_thread|
+void DiskCache::JournalEntry(Shard &shard, const SnapshotEntry &snapshot) {
+  const Entry &entry = snapshot.entry;
+  std::string sha1_key = snapshot.sha1_key.ToString();
+  shard.journal->Append(Journal::ACTION_UPDATE, sha1_key, entry.size,
+      entry.segment, entry.offset);
+  if (shard.evictor->ShouldJournalRegion(entry.region)) {
+    shard.journal->Append(Journal::ACTION_REGION, sha1_key, entry.region);
+  }
+  ++shard.redundant_count;
 }
 
-void DiskCache::HandleLineForUpdate(const std::string &sha1_key, 
-    long file_size) {
+void DiskCache::HandleRecordForUpdate(Shard &shard, const std::string &sha1_key,
+    long file_size, int segment, long offset) {
 
-  auto iter = entry_map_.find(sha1_key);
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
 
   LOG_V("lru::Diskcache", "new=%d, new entry: %s, %ld", 
-      iter == entry_map_.end(), sha1_key.c_str(), file_size);
+      handle == EntryIndex::INVALID_HANDLE, Sha1KeyToHex(sha1_key).c_str(),
+      file_size);
+
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    Entry &entry = shard.entries.ValueOf(handle);
 
-  if (iter != entry_map_.end()) {
     // minus old file_size
-    cur_cache_size_ -= iter->second->second;
-    iter->second->second = file_size;
+    shard.cache_size -= entry.size;
+    cur_cache_size_ -= entry.size;
+    if (entry.segment >= 0) {
+      shard.segments->RemoveLive(entry.segment, entry.size);
+    }
+    entry.size = file_size;
+    entry.segment = segment;
+    entry.offset = offset;
 
-    entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-    iter->second = entry_list_.begin();
+    shard.evictor->OnHit(handle);
 
-    ++redundant_count_;
+    ++shard.redundant_count;
 
   } else {
-    entry_list_.emplace_front(sha1_key, file_size);
-    entry_map_.emplace(sha1_key, entry_list_.begin());
+    handle = shard.entries.PushFront(Sha1Key(sha1_key),
+        Entry(file_size, segment, offset));
+    shard.evictor->OnInsert(handle);
+    ++cur_item_count_;
   }
 
+  if (segment >= 0) {
+    AddToSegment(shard, sha1_key, segment, offset, file_size);
+  }
+
+  shard.cache_size += file_size;
   cur_cache_size_ += file_size;
 }
 
-void DiskCache::HandleLineForDelete(const std::string &sha1_key) {
-  auto iter = entry_map_.find(sha1_key);
-  if (iter != entry_map_.end()) {
-    cur_cache_size_ -= iter->second->second;
-    entry_map_.erase(iter);
-    entry_list_.erase(iter->second); 
+// unlike an update, moving a packed entry leaves its recency alone
+void DiskCache::HandleRecordForMove(Shard &shard, const std::string &sha1_key,
+    int segment, long offset) {
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle != EntryIndex::INVALID_HANDLE &&
+      shard.entries.ValueOf(handle).segment >= 0) {
+    Entry &entry = shard.entries.ValueOf(handle);
+    shard.segments->RemoveLive(entry.segment, entry.size);
+    AddToSegment(shard, sha1_key, segment, offset, entry.size);
+    entry.segment = segment;
+    entry.offset = offset;
+  }
+  ++shard.redundant_count;
+}
+
+void DiskCache::HandleRecordForDelete(Shard &shard,
+    const std::string &sha1_key) {
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    EraseEntry(shard, handle);
+  }
+  ++shard.redundant_count;
+}
+
+void DiskCache::HandleRecordForRead(Shard &shard, const std::string &sha1_key) {
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    shard.evictor->OnHit(handle);
   }
-  ++redundant_count_;
+  ++shard.redundant_count;
 }
 
-void DiskCache::HandleLineForRead(const std::string &sha1_key) {
-  auto iter = entry_map_.find(sha1_key);
-  if (iter != entry_map_.end()) {
-    // move item to front
-    entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-    iter->second = entry_list_.begin();
+// only written by rewriting the journal, right after the update record of
+// the entry, so it is not redundant
+void DiskCache::HandleRecordForRegion(Shard &shard,
+    const std::string &sha1_key, unsigned char region) {
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    shard.evictor->Restore(handle, region);
   }
-  ++redundant_count_;
 }
 
 bool DiskCache::Put(const std::string &key, WriteCacheDataFun &&fun) {
@@ -198,20 +388,25 @@ bool DiskCache::Put(const std::string &key, WriteCacheDataFun &&fun) {
     return false;
   }
 
-  std::string sha1_key = GenSha1Key(key);
+  std::string sha1_key = HashKey(key);
+  Shard &shard = GetShard(sha1_key);
+  return CoalescePut(shard, sha1_key, [this, &shard, &sha1_key, &fun]{
+        return PutFile(shard, sha1_key, fun);
+      });
+}
+
+bool DiskCache::PutFile(Shard &shard, const std::string &sha1_key,
+    WriteCacheDataFun &fun) {
+  std::string file = GetCacheFile(sha1_key);
 
-  std::string dir(cache_dir_);
-  dir.append(1, '/');
-  dir.append(sha1_key.c_str(), 2);
+  std::string dir(file, 0, file.rfind('/'));
   if (!FileUtil::DirExists(dir) && !FileUtil::MakeDirs(dir)) {
     LOG_E("lru::DiskCache", "failed to create dir: %s", dir.c_str());
     return false;
   }
 
-  std::string file = GetCacheFile(sha1_key);
-
   // write cache data to a tmp file
-  std::string tmp_file(file + ".tmp");
+  std::string tmp_file(file + ".tmp" + std::to_string(++tmp_file_seq_));
   auto data_ofstream = std::ofstream(tmp_file, std::ios::binary);
   if (!fun(data_ofstream)) {
     LOG_E("lru::DiskCache", "writing to file failed: %s", tmp_file.c_str());
@@ -221,115 +416,659 @@ bool DiskCache::Put(const std::string &key, WriteCacheDataFun &&fun) {
   long file_size = data_ofstream.tellp();
   data_ofstream.close();
 
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (!IsInitialized()) {
-    cond_.wait(lock);
+  return CommitEntry(shard, sha1_key, tmp_file, file_size, -1, 0);
+}
+
+bool DiskCache::Put(const std::string &key, const void *data,
+    std::size_t len) {
+  if (key.size() == 0) {
+    LOG_E("lru::DiskCache", "key is empty");
+    return false;
   }
 
-  // on success, rename the tmp file
-  std::rename(tmp_file.c_str(), file.c_str());
+  std::string sha1_key = HashKey(key);
+  Shard &shard = GetShard(sha1_key);
+  return CoalescePut(shard, sha1_key, [this, &shard, &sha1_key, data, len]{
+        return PutBuffer(shard, sha1_key, data, len);
+      });
+}
 
-  cur_cache_size_ += file_size;
+std::vector<bool> DiskCache::PutBatch(
+    const std::vector<std::pair<std::string, std::string>> &entries) {
+  std::vector<BatchWrite> writes(entries.size());
+  for (std::size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].first.size() == 0) {
+      LOG_E("lru::DiskCache", "key is empty");
+      continue;
+    }
+    writes[i].sha1_key = HashKey(entries[i].first);
+  }
 
-  auto iter = entry_map_.find(sha1_key);
-  if (iter != entry_map_.end()) {
-    entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-    iter->second = entry_list_.begin();
+  io_pool_->ParallelFor(entries.size(), [this, &entries, &writes](
+        std::size_t i) {
+    BatchWrite &write = writes[i];
+    if (write.sha1_key.empty()) {
+      return;
+    }
 
-    cur_cache_size_ -= iter->second->second;
-    iter->second->second = file_size;
+    const std::string &data = entries[i].second;
+    write.size = data.size();
+    write.ok = WriteBuffer(GetShard(write.sha1_key), write.sha1_key,
+        data.data(), data.size(), &write.tmp_file, &write.segment,
+        &write.offset);
+  });
 
-  } else {
-    entry_list_.emplace_front(sha1_key, file_size);
-    entry_map_.emplace(sha1_key, entry_list_.begin());
+  std::vector<std::vector<BatchWrite *>> by_shard(shards_.size());
+  for (auto &write : writes) {
+    if (write.ok) {
+      by_shard[GetShard(write.sha1_key).index].push_back(&write);
+    }
+  }
+  for (auto &shard : shards_) {
+    if (!by_shard[shard->index].empty()) {
+      CommitEntries(*shard, by_shard[shard->index]);
+    }
   }
 
-  LOG_V("lru::DiskCache", "entries: %ld, write file_size: %ld, %s=%ld", 
-      entry_list_.size(), cur_cache_size_, sha1_key.c_str(), file_size);
+  std::vector<bool> results(writes.size());
+  for (std::size_t i = 0; i < writes.size(); ++i) {
+    results[i] = writes[i].ok;
+  }
+  return results;
+}
+
+bool DiskCache::PutBuffer(Shard &shard, const std::string &sha1_key,
+    const void *data, std::size_t len) {
+  std::string tmp_file;
+  int segment;
+  long offset;
+  if (!WriteBuffer(shard, sha1_key, data, len, &tmp_file, &segment,
+        &offset)) {
+    return false;
+  }
+  return CommitEntry(shard, sha1_key, tmp_file, len, segment, offset);
+}
+
+// appends |data| to a segment if it is small enough, and sets |segment| and
+// |offset|, or else writes it to |tmp_file| and sets |segment| to -1. the
+// segment stays pinned until the entry is committed
+bool DiskCache::WriteBuffer(Shard &shard, const std::string &sha1_key,
+    const void *data, std::size_t len, std::string *tmp_file, int *segment,
+    long *offset) {
+  if (packed_max_size_ > 0 && static_cast<long>(len) <= packed_max_size_) {
+    if (shard.segments->Append(data, len, segment, offset)) {
+      tmp_file->clear();
+      return true;
+    }
+    // a file of its own will do then
+  }
+  *segment = -1;
+  *offset = 0;
+
+  int fd = OpenTmpFile(sha1_key, tmp_file);
+  if (fd < 0) {
+    return false;
+  }
+
+  const char *p = static_cast<const char *>(data);
+  std::size_t remaining = len;
+  while (remaining > 0) {
+    ssize_t written = ::write(fd, p, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      LOG_E("lru::DiskCache", "writing to file failed: %s", tmp_file->c_str());
+      ::close(fd);
+      ::unlink(tmp_file->c_str());
+      return false;
+    }
+    p += written;
+    remaining -= written;
+  }
+  ::close(fd);
+
+  return true;
+}
+
+bool DiskCache::CoalescePut(Shard &shard, const std::string &sha1_key,
+    std::function<bool()> &&write) {
+  std::unique_lock<std::mutex> lock(shard.flight_mutex);
+
+  std::shared_ptr<PutFlight> &slot = shard.put_flights[sha1_key];
+  if (!slot) {
+    slot = std::make_shared<PutFlight>();
+  }
+  std::shared_ptr<PutFlight> flight = slot;
+
+  // a batch left by the writer has not been claimed yet, this Put is newer
+  std::shared_ptr<CoalescedPuts> batch;
+  if (flight->writing || flight->next) {
+    if (!flight->next) {
+      flight->next = std::make_shared<CoalescedPuts>();
+    }
+    batch = flight->next;
+    // the data of the Puts waiting so far is never written
+    batch->write = std::move(write);
+
+    shard.flight_cond.wait(lock, [&flight, &batch]{
+          return batch->done || (!flight->writing && flight->next == batch);
+        });
+    if (batch->done) {
+      return batch->result;
+    }
+
+    flight->next.reset();
+    write = std::move(batch->write);
+  }
+
+  flight->writing = true;
+  lock.unlock();
+  bool result = write();
+  lock.lock();
 
-  EnqueueAction([this, sha1_key, file_size, iter]{
-    // write a log to the journal
-    journal_ofstream_ << ACTION_UPDATE 
-      << ' ' 
-      << sha1_key 
-      << ' ' 
-      << file_size 
-      << std::endl;
+  flight->writing = false;
+  if (batch) {
+    batch->done = true;
+    batch->result = result;
+  }
+  if (!flight->next) {
+    shard.put_flights.erase(sha1_key);
+  }
+  shard.flight_cond.notify_all();
+  return result;
+}
 
-    if (iter != entry_map_.end()) {
-      ++redundant_count_;
-      //LOG_E("lru::DiskCache", "existing key: %s, redundant: %d", 
-        //sha1_key.c_str(), redundant_count_);
+// creates a new |tmp_file| for the cache file of |sha1_key| and returns
+// its fd, or -1 on error
+int DiskCache::OpenTmpFile(const std::string &sha1_key,
+    std::string *tmp_file) {
+  // concurrent Puts of the same key must not share the tmp file
+  std::string file = GetCacheFile(sha1_key);
+  tmp_file->assign(file + ".tmp" + std::to_string(++tmp_file_seq_));
+
+  // the subdirectory is created only when it turns out to be missing,
+  // which saves a stat for every Put
+  int fd = ::open(tmp_file->c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      0644);
+  if (fd < 0 && errno == ENOENT) {
+    std::string dir(file, 0, file.rfind('/'));
+    if (!FileUtil::MakeDirs(dir)) {
+      LOG_E("lru::DiskCache", "failed to create dir: %s", dir.c_str());
+      return -1;
     }
+    fd = ::open(tmp_file->c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+  }
+  if (fd < 0) {
+    LOG_E("lru::DiskCache", "failed to create file: %s", tmp_file->c_str());
+  }
+  return fd;
+}
+
+// moves the completely written |tmp_file| in place and updates the index,
+// |tmp_file| is empty for an entry packed at |offset| of |segment|
+bool DiskCache::CommitEntry(Shard &shard, const std::string &sha1_key,
+    const std::string &tmp_file, long file_size, int segment, long offset) {
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  bool ready = WaitForInitialization(shard, lock);
+
+  // on success, rename the tmp file
+  if (!tmp_file.empty()) {
+    std::rename(tmp_file.c_str(), GetCacheFile(sha1_key).c_str());
+  }
+
+  if (!ready) {
+    shard.pending_ops.emplace_back(Journal::ACTION_UPDATE, sha1_key,
+        file_size, segment, offset);
+    return true;
+  }
 
-    EvictIfNeeded();
+  IndexUpdate update(UpdateIndex(shard, sha1_key, file_size, segment,
+        offset));
+  if (segment >= 0) {
+    shard.segments->Unpin(segment);
+  }
+
+  // enqueued before unlocking, so records of the same key reach the journal
+  // in the order the index was changed, segment compaction relies on that
+  EnqueueAction(shard, [this, &shard, update]{
+    JournalUpdate(shard, update);
+    EvictIfNeeded(shard);
+    CompactSegmentsIfNeeded(shard);
   });
 
   return true;
 }
 
-void DiskCache::EvictIfNeeded() {
-  if (cur_cache_size_ > max_cache_size_ || 
-      entry_list_.size() > max_item_count_) {
+// the same as CommitEntry() for all the successful |writes| of a shard,
+// under a single lock and with a single action
+void DiskCache::CommitEntries(Shard &shard,
+    const std::vector<BatchWrite *> &writes) {
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  bool ready = WaitForInitialization(shard, lock);
+
+  std::vector<IndexUpdate> updates;
+  for (BatchWrite *write : writes) {
+    if (!write->ok) {
+      continue;
+    }
+
+    if (!write->tmp_file.empty()) {
+      std::rename(write->tmp_file.c_str(),
+          GetCacheFile(write->sha1_key).c_str());
+    }
+
+    if (!ready) {
+      shard.pending_ops.emplace_back(Journal::ACTION_UPDATE, write->sha1_key,
+          write->size, write->segment, write->offset);
+    } else {
+      updates.push_back(UpdateIndex(shard, write->sha1_key, write->size,
+            write->segment, write->offset));
+      if (write->segment >= 0) {
+        shard.segments->Unpin(write->segment);
+      }
+    }
+  }
+
+  if (updates.empty()) {
+    return;
+  }
+
+  EnqueueAction(shard, [this, &shard, updates]{
+    for (auto &update : updates) {
+      JournalUpdate(shard, update);
+    }
+    EvictIfNeeded(shard);
+    CompactSegmentsIfNeeded(shard);
+  });
+}
+
+// puts the entry in the index, the shard is locked and initialized
+DiskCache::IndexUpdate DiskCache::UpdateIndex(Shard &shard,
+    const std::string &sha1_key, long file_size, int segment, long offset) {
+  IndexUpdate update(sha1_key, file_size, segment, offset);
+
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  update.replaced = handle != EntryIndex::INVALID_HANDLE;
+  if (update.replaced) {
+    update.promoted = PromoteEntry(shard, handle);
+
+    Entry &entry = shard.entries.ValueOf(handle);
+    shard.cache_size -= entry.size;
+    cur_cache_size_ -= entry.size;
+    if (entry.segment >= 0) {
+      shard.segments->RemoveLive(entry.segment, entry.size);
+    } else {
+      update.drop_file = segment >= 0;
+    }
+    entry.size = file_size;
+    entry.segment = segment;
+    entry.offset = offset;
+
+  } else {
+    handle = shard.entries.PushFront(Sha1Key(sha1_key),
+        Entry(file_size, segment, offset));
+    shard.evictor->OnInsert(handle);
+    ++cur_item_count_;
+  }
+
+  // the update record promotes the entry as a read record would
+  shard.entries.ValueOf(handle).read_epoch = shard.read_epoch;
+  update.region = shard.entries.ValueOf(handle).region;
+
+  if (segment >= 0) {
+    AddToSegment(shard, sha1_key, segment, offset, file_size);
+  }
+
+  shard.cache_size += file_size;
+  cur_cache_size_ += file_size;
+
+  LOG_V("lru::DiskCache", "entries: %ld, write file_size: %ld, %s=%ld", 
+      cur_item_count_.load(), cur_cache_size_.load(),
+      Sha1KeyToHex(sha1_key).c_str(), file_size);
+
+  return update;
+}
+
+// runs on |action_thread|
+void DiskCache::JournalUpdate(Shard &shard, const IndexUpdate &update) {
+  // write a log to the journal
+  shard.journal->Append(Journal::ACTION_UPDATE, update.sha1_key, update.size,
+      update.segment, update.offset);
+  if (update.promoted) {
+    shard.journal->Append(Journal::ACTION_REGION, update.sha1_key,
+        update.region);
+  }
+
+  if (update.replaced) {
+    ++shard.redundant_count;
+  }
+
+  if (update.drop_file) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // keep the file if it has been put for the key again
+    EntryHandle handle = shard.entries.Find(Sha1Key(update.sha1_key));
+    if (handle == EntryIndex::INVALID_HANDLE ||
+        shard.entries.ValueOf(handle).segment >= 0) {
+      file_reaper_->Dispose(GetCacheFile(update.sha1_key));
+    }
+  }
+}
+
+void DiskCache::EvictIfNeeded(Shard &shard) {
+  if (cur_cache_size_ <= max_cache_size_ * eviction_high_watermark_ &&
+      cur_item_count_ <= max_item_count_ * eviction_high_watermark_) {
+    return;
+  }
+
+  LOG_D("lru::DiskCache", "start eviction, entries: %ld, size: %ld",
+      cur_item_count_.load(), cur_cache_size_.load());
 
-    LOG_D("lru::DiskCache", "start eviction, entries: %zd, size: %ld", 
-        entry_list_.size(), cur_cache_size_);
+  // the limits are global, so every shard is asked to shrink to its share
+  // of the low watermark, each on its own thread
+  for (auto &other : shards_) {
+    ScheduleEvictionBatch(*other);
+  }
+
+  // entries may be put faster than the batches evict them, once the cache
+  // is beyond its limits by more than the band between the watermarks, a
+  // shard is trimmed back to its share of the limits right away
+  float ceiling = 1.0f + eviction_high_watermark_ - eviction_low_watermark_;
+  if (cur_cache_size_ > max_cache_size_ * ceiling ||
+      cur_item_count_ > max_item_count_ * ceiling) {
+    EvictEntries(shard, 1.0f, false);
+  }
+}
 
-    std::lock_guard<std::mutex> lock(mutex_);
+void DiskCache::ScheduleEvictionBatch(Shard &shard) {
+  if (!shard.eviction_pending.exchange(true)) {
+    Shard *s = &shard;
+    EnqueueAction(shard, [this, s]{
+      s->eviction_pending = false;
+      // the next batch is queued behind the actions queued meanwhile
+      if (!EvictEntries(*s, eviction_low_watermark_,
+            eviction_batch_us_ > 0)) {
+        ScheduleEvictionBatch(*s);
+      }
+      CompactSegmentsIfNeeded(*s);
+    });
+  }
+}
 
-    long target_size = max_cache_size_ * RETAIN_RATIO;
-    long target_count = max_item_count_ * RETAIN_RATIO;
+// runs on |action_thread|. entries are taken out of the index a chunk at a
+// time, and their files deleted and their records journaled after
+// unlocking, until the shard is down to its share of |watermark| of the
+// limits, or until |eviction_batch_us_| is over if |timed|. returns true
+// if the shard got down to its share
+bool DiskCache::EvictEntries(Shard &shard, float watermark, bool timed) {
+  long target_size = max_cache_size_ * watermark / shards_.size();
+  long target_count = max_item_count_ * watermark / shards_.size();
+  auto deadline = std::chrono::steady_clock::now() +
+    std::chrono::microseconds(eviction_batch_us_);
+
+  std::vector<SnapshotEntry> evicted;
+  bool done = false;
+  while (!done) {
+    evicted.clear();
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      auto over_target = [&shard, target_size, target_count]{
+        return shard.cache_size > target_size ||
+          static_cast<long>(shard.entries.Size()) > target_count;
+      };
+      shard.evictor->Evict([&over_target, &evicted]{
+            return evicted.size() < EVICTION_CHUNK_SIZE && over_target();
+          },
+          [this, &shard, &evicted](EntryHandle victim){
+            evicted.push_back(SnapshotEntry{
+                shard.entries.KeyOf(victim), shard.entries.ValueOf(victim)});
+            EraseEntry(shard, victim);
+          });
+
+      // nothing left to evict if no entry was
+      done = !over_target() || evicted.empty();
+    }
 
-    LOG_V("lru::DiskCache", 
-        "entries=%zd, cur_cache_size=%ld, going to remove...",
-        entry_list_.size(), cur_cache_size_);
+    for (auto &snapshot : evicted) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
 
-    while (cur_cache_size_ > target_size || 
-        entry_list_.size() > target_count) {
-      auto &item = entry_list_.back();    
-      RemoveWithoutLocking(item.first, true);
+      // the key may have been put again since it was evicted, the new
+      // file must be kept then
+      if (shard.entries.Find(snapshot.sha1_key) ==
+          EntryIndex::INVALID_HANDLE) {
+        DeleteCacheFileAndWriteJournal(shard, snapshot.sha1_key.ToString(),
+            snapshot.entry.segment < 0);
+      }
     }
 
-    LOG_D("lru::DiskCache", "after eviction, entries: %zd, size: %ld", 
-        entry_list_.size(), cur_cache_size_);
+    if (timed && std::chrono::steady_clock::now() >= deadline) {
+      break;
+    }
   }
+
+  LOG_V("lru::DiskCache", "shard=%d, entries=%zd, cache_size=%ld, "
+      "eviction %s", shard.index, shard.entries.Size(), shard.cache_size,
+      done ? "done" : "continues");
+  return done;
 }
 
 bool DiskCache::Get(const std::string &key, ReadCacheDataFun &&fun) {
-  std::string sha1_key = GenSha1Key(key);
+  return ReadEntry(key, &fun, nullptr);
+}
+
+bool DiskCache::GetStream(const std::string &key, ReadStreamFun &&fun) {
+  return ReadEntry(key, nullptr, &fun);
+}
+
+bool DiskCache::ReadEntry(const std::string &key, ReadCacheDataFun *file_fun,
+    ReadStreamFun *stream_fun) {
+  std::string sha1_key = HashKey(key);
 
   std::ifstream fin;
+  bool packed = false;
+  int packed_fd = -1;
+  long packed_offset = 0;
+  long packed_size = 0;
+  if (!OpenCacheFileForRead(GetShard(sha1_key), sha1_key,
+        [&](const std::string &file, long offset, long size) {
+          if (offset >= 0) {
+            // the entry is there even if it cannot be handed to |file_fun|
+            packed = true;
+            if (!stream_fun) {
+              return true;
+            }
+            packed_fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+            packed_offset = offset;
+            packed_size = size;
+            return packed_fd >= 0;
+          }
+
+          fin.open(file, std::ios::binary);
+          return fin.is_open();
+        })) {
+    return false;
+  }
 
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (!IsInitialized()) {
-    cond_.wait(lock);
+  if (!packed) {
+    return file_fun ? (*file_fun)(fin) : (*stream_fun)(fin);
   }
 
-  auto iter = entry_map_.find(sha1_key);
-  if (iter != entry_map_.end()) {
-    std::string file = GetCacheFile(sha1_key);
+  if (!stream_fun) {
+    LOG_V("lru::DiskCache", "packed entry read with Get(): %s",
+        Sha1KeyToHex(sha1_key).c_str());
+    return false;
+  }
+
+  // packed entries are small, they are read into memory and handed out
+  // through an istream of their own
+  std::string data(packed_size, '\0');
+  ssize_t count = ::pread(packed_fd, &data[0], packed_size, packed_offset);
+  ::close(packed_fd);
+  if (count != packed_size) {
+    LOG_E("lru::DiskCache", "failed to read packed entry: %s",
+        Sha1KeyToHex(sha1_key).c_str());
+    return false;
+  }
+
+  std::stringbuf packed_data(data);
+  std::istream packed_in(&packed_data);
+  return (*stream_fun)(packed_in);
+}
 
-    if (FileUtil::FileExists(file)) {
-      // move item to front
-      entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-      iter->second = entry_list_.begin();
+std::shared_ptr<const MappedFile> DiskCache::GetMapped(
+    const std::string &key) {
+  std::string sha1_key = HashKey(key);
+
+  int fd = -1;
+  long data_offset = -1;
+  long data_size = 0;
+  if (!OpenCacheFileForRead(GetShard(sha1_key), sha1_key,
+        [&](const std::string &file, long offset, long size) {
+          fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+          data_offset = offset;
+          data_size = size;
+          return fd >= 0;
+        })) {
+    return nullptr;
+  }
+
+  std::shared_ptr<MappedFile> mapped_file = std::make_shared<MappedFile>();
+  bool mapped = data_offset < 0 ? mapped_file->Map(fd) :
+    mapped_file->Map(fd, data_offset, data_size);
+  ::close(fd);
+
+  return mapped ? mapped_file : nullptr;
+}
+
+long DiskCache::GetToFd(const std::string &key, int out_fd, long offset,
+    long length) {
+  std::string sha1_key = HashKey(key);
+
+  int fd = -1;
+  long data_offset = -1;
+  long data_size = 0;
+  if (!OpenCacheFileForRead(GetShard(sha1_key), sha1_key,
+        [&](const std::string &file, long offset, long size) {
+          fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+          data_offset = offset;
+          data_size = size;
+          return fd >= 0;
+        })) {
+    return -1;
+  }
+
+  // an entry of its own is as large as its file
+  if (data_offset < 0) {
+    struct stat stat_buf;
+    if (::fstat(fd, &stat_buf) != 0) {
+      ::close(fd);
+      return -1;
+    }
+    data_offset = 0;
+    data_size = stat_buf.st_size;
+  }
+
+  if (offset < 0) {
+    ::close(fd);
+    return -1;
+  }
+
+  long remaining = data_size - offset;
+  if (length >= 0 && length < remaining) {
+    remaining = length;
+  }
+
+  long total = 0;
+  while (remaining > 0) {
+#ifdef __linux__
+    off_t off = data_offset + offset + total;
+    ssize_t sent = ::sendfile(out_fd, fd, &off, remaining);
+#else
+    char buf[64 * 1024];
+    ssize_t sent = ::pread(fd, buf,
+        remaining < (long)sizeof(buf) ? remaining : sizeof(buf),
+        data_offset + offset + total);
+    if (sent > 0) {
+      sent = ::write(out_fd, buf, sent);
+    }
+#endif
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent <= 0) {
+      if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOG_E("lru::DiskCache", "sendfile failed: %s", strerror(errno));
+        total = total > 0 ? total : -1;
+      }
+      break;
+    }
+
+    total += sent;
+    remaining -= sent;
+  }
+
+  ::close(fd);
+  return total;
+}
+
+// looks up |sha1_key| and promotes it on hit. |open_file| is called with the
+// cache file or segment while the lock is held, so whatever it opens stays
+// valid even if the entry is removed or moved right after the lock is
+// released
+bool DiskCache::OpenCacheFileForRead(Shard &shard,
+    const std::string &sha1_key,
+    const std::function<bool(const std::string &file, long offset,
+      long size)> &open_file) {
+
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  if (!WaitForInitialization(shard, lock)) {
+    // the index is incomplete, the file itself tells whether the key is
+    // cached, the promotion is recorded once replaying is done
+    if (!open_file(GetCacheFile(sha1_key), -1, 0)) {
+      return false;
+    }
+
+    shard.pending_ops.emplace_back(Journal::ACTION_READ, sha1_key, 0);
+    return true;
+  }
+
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    Entry &entry = shard.entries.ValueOf(handle);
+    bool opened = entry.segment < 0 ?
+      open_file(GetCacheFile(sha1_key), -1, entry.size) :
+      open_file(shard.segments->GetSegmentFile(entry.segment), entry.offset,
+          entry.size);
+    if (opened) {
+      if (PromoteEntry(shard, handle)) {
+        // enqueued before unlocking, ahead of any later record of the key
+        SnapshotEntry snapshot{ Sha1Key(sha1_key), entry };
+        EnqueueAction(shard, [this, &shard, snapshot]{
+          JournalEntry(shard, snapshot);
+        });
+        return true;
+      }
+
+      if (!ShouldJournalRead(shard, entry)) {
+        return true;
+      }
 
       lock.unlock();
 
-      EnqueueAction([this, sha1_key]{
+      EnqueueAction(shard, [this, &shard, sha1_key]{
         // write a log to the journal
-        journal_ofstream_ << ACTION_READ << ' ' << sha1_key << std::endl; 
-        ++redundant_count_;
-
-        CompactJournalIfNeeded(true, false);
+        shard.journal->Append(Journal::ACTION_READ, sha1_key, 0);
+        ++shard.redundant_count;
       });
 
-      fin.open(file, std::ios::binary);
-      return fun(fin);
+      return true;
 
     } else {
-      EnqueueAction([this, sha1_key]{
-        RemoveWithLocking(sha1_key);
+      EnqueueAction(shard, [this, &shard, sha1_key]{
+        RemoveWithLocking(shard, sha1_key);
       });
     }
 
@@ -338,147 +1077,767 @@ bool DiskCache::Get(const std::string &key, ReadCacheDataFun &&fun) {
   return false;
 }
 
-void DiskCache::Remove(const std::string &key) {
-  std::string sha1_key = GenSha1Key(key);
-  RemoveWithLocking(sha1_key);
+// with read epochs, a read is journaled only if the entry has not been
+// journaled in the current epoch yet
+bool DiskCache::ShouldJournalRead(Shard &shard, Entry &entry) {
+  if (read_journal_epoch_ms_ <= 0) {
+    return true;
+  }
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - shard.read_epoch_start >=
+      std::chrono::milliseconds(read_journal_epoch_ms_)) {
+    ++shard.read_epoch;
+    shard.read_epoch_start = now;
+  }
+
+  if (entry.read_epoch == shard.read_epoch) {
+    return false;
+  }
+
+  entry.read_epoch = shard.read_epoch;
+  return true;
 }
 
-bool DiskCache::RemoveWithLocking(const std::string &sha1_key) {
-  std::unique_lock<std::mutex> lock(mutex_);
-  if (!IsInitialized()) {
-    cond_.wait(lock);
+bool DiskCache::GetOrLoad(const std::string &key, std::string *data,
+    LoadFun &&loader) {
+  auto read = [data](std::istream &fin) {
+    data->assign(std::istreambuf_iterator<char>(fin),
+        std::istreambuf_iterator<char>());
+    return !fin.bad();
+  };
+  if (GetStream(key, read)) {
+    return true;
+  }
+
+  std::string sha1_key = HashKey(key);
+  Shard &shard = GetShard(sha1_key);
+
+  std::unique_lock<std::mutex> lock(shard.flight_mutex);
+  auto it = shard.load_flights.find(sha1_key);
+  if (it != shard.load_flights.end()) {
+    std::shared_ptr<LoadFlight> flight = it->second;
+    shard.flight_cond.wait(lock, [&flight]{ return flight->done; });
+    if (flight->ok) {
+      *data = flight->data;
+    }
+    return flight->ok;
+  }
+
+  std::shared_ptr<LoadFlight> flight(std::make_shared<LoadFlight>());
+  shard.load_flights.emplace(sha1_key, flight);
+  lock.unlock();
+
+  // another loader of the key may have been done before this one got in
+  bool ok = GetStream(key, read);
+  if (!ok) {
+    ok = loader(data);
+    if (ok) {
+      Put(key, data->data(), data->size());
+    }
   }
 
-  return RemoveWithoutLocking(sha1_key, false);
+  lock.lock();
+  shard.load_flights.erase(sha1_key);
+  flight->done = true;
+  flight->ok = ok;
+  if (ok && flight.use_count() > 1) {
+    flight->data = *data;
+  }
+  shard.flight_cond.notify_all();
+  return ok;
 }
 
-bool DiskCache::RemoveWithoutLocking(const std::string &sha1_key, 
-    bool in_background) {
-  auto iter = entry_map_.find(sha1_key);
-  if (iter == entry_map_.end()) {
+std::vector<bool> DiskCache::GetBatch(const std::vector<std::string> &keys,
+    std::vector<std::string> *values) {
+  values->assign(keys.size(), std::string());
+
+  std::vector<std::vector<BatchRead>> by_shard(shards_.size());
+  for (std::size_t i = 0; i < keys.size(); ++i) {
+    std::string sha1_key = HashKey(keys[i]);
+    by_shard[GetShard(sha1_key).index].emplace_back(i, sha1_key);
+  }
+
+  std::vector<BatchRead> opened;
+  opened.reserve(keys.size());
+  for (auto &shard : shards_) {
+    if (!by_shard[shard->index].empty()) {
+      OpenCacheFilesForRead(*shard, &by_shard[shard->index], &opened);
+    }
+  }
+
+  // not a std::vector<bool>, whose elements cannot be set concurrently
+  std::vector<char> read(opened.size(), 0);
+  io_pool_->ParallelFor(opened.size(), [&opened, &read, values](
+        std::size_t i) {
+    read[i] = ReadCacheFile(opened[i], &(*values)[opened[i].index]);
+    ::close(opened[i].fd);
+  });
+
+  std::vector<bool> found(keys.size(), false);
+  for (std::size_t i = 0; i < opened.size(); ++i) {
+    found[opened[i].index] = read[i];
+  }
+  return found;
+}
+
+// the same as OpenCacheFileForRead() for all |reads| of a shard, under a
+// single lock and with a single action journaling the reads. the ones
+// opened are added to |opened|
+void DiskCache::OpenCacheFilesForRead(Shard &shard,
+    std::vector<BatchRead> *reads, std::vector<BatchRead> *opened) {
+  std::vector<std::string> journaled;
+  std::vector<SnapshotEntry> promoted;
+  std::vector<std::string> broken;
+
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  if (!WaitForInitialization(shard, lock)) {
+    for (auto &read : *reads) {
+      read.fd = ::open(GetCacheFile(read.sha1_key).c_str(),
+          O_RDONLY | O_CLOEXEC);
+      if (read.fd >= 0) {
+        shard.pending_ops.emplace_back(Journal::ACTION_READ, read.sha1_key,
+            0);
+        opened->push_back(read);
+      }
+    }
     return;
   }
 
-  LOG_V("lru::DiskCache", ">>>>> removing... %s, %d", 
-      sha1_key.c_str(), iter != entry_map_.end());
+  for (auto &read : *reads) {
+    EntryHandle handle = shard.entries.Find(Sha1Key(read.sha1_key));
+    if (handle == EntryIndex::INVALID_HANDLE) {
+      continue;
+    }
 
-  if (iter != entry_map_.end()) {
-    if (in_background) {
-      DeleteCacheFileAndWriteJournal(sha1_key, iter);
+    Entry &entry = shard.entries.ValueOf(handle);
+    if (entry.segment < 0) {
+      read.fd = ::open(GetCacheFile(read.sha1_key).c_str(),
+          O_RDONLY | O_CLOEXEC);
     } else {
-      EnqueueAction([this, sha1_key, iter]{
-        DeleteCacheFileAndWriteJournal(sha1_key, iter);
+      read.fd = ::open(shard.segments->GetSegmentFile(entry.segment).c_str(),
+          O_RDONLY | O_CLOEXEC);
+      read.offset = entry.offset;
+      read.size = entry.size;
+    }
+    if (read.fd < 0) {
+      broken.push_back(read.sha1_key);
+      continue;
+    }
+
+    if (PromoteEntry(shard, handle)) {
+      promoted.push_back(SnapshotEntry{ Sha1Key(read.sha1_key), entry });
+    } else if (ShouldJournalRead(shard, entry)) {
+      journaled.push_back(read.sha1_key);
+    }
+    opened->push_back(read);
+  }
+  if (!promoted.empty()) {
+    EnqueueAction(shard, [this, &shard, promoted]{
+      for (auto &snapshot : promoted) {
+        JournalEntry(shard, snapshot);
+      }
+    });
+  }
+  lock.unlock();
+
+  if (!journaled.empty()) {
+    EnqueueAction(shard, [&shard, journaled]{
+      for (auto &sha1_key : journaled) {
+        shard.journal->Append(Journal::ACTION_READ, sha1_key, 0);
+        ++shard.redundant_count;
+      }
+    });
+  }
+  if (!broken.empty()) {
+    EnqueueAction(shard, [this, &shard, broken]{
+      for (auto &sha1_key : broken) {
+        RemoveWithLocking(shard, sha1_key);
+      }
+    });
+  }
+}
+
+// reads the data of an entry opened for reading into |data|, a file of its
+// own is read as a whole
+bool DiskCache::ReadCacheFile(const BatchRead &read, std::string *data) {
+  long offset = read.offset;
+  long size = read.size;
+  if (offset < 0) {
+    struct stat stat_buf;
+    if (::fstat(read.fd, &stat_buf) != 0) {
+      return false;
+    }
+    offset = 0;
+    size = stat_buf.st_size;
+  }
+
+  data->resize(size);
+  long total = 0;
+  while (total < size) {
+    ssize_t count = ::pread(read.fd, &(*data)[total], size - total,
+        offset + total);
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      LOG_E("lru::DiskCache", "failed to read entry: %s",
+          Sha1KeyToHex(read.sha1_key).c_str());
+      data->clear();
+      return false;
+    }
+    total += count;
+  }
+  return true;
+}
+
+void DiskCache::GetAsync(const std::string &key, GetAsyncFun &&callback) {
+  std::string sha1_key = HashKey(key);
+
+  int fd = -1;
+  long data_offset = -1;
+  long data_size = 0;
+  if (!OpenCacheFileForRead(GetShard(sha1_key), sha1_key,
+        [&](const std::string &file, long offset, long size) {
+          fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+          data_offset = offset;
+          data_size = size;
+          return fd >= 0;
+        })) {
+    callback(false, std::string());
+    return;
+  }
+
+  if (data_offset < 0) {
+    struct stat stat_buf;
+    if (::fstat(fd, &stat_buf) != 0) {
+      ::close(fd);
+      callback(false, std::string());
+      return;
+    }
+    data_offset = 0;
+    data_size = stat_buf.st_size;
+  }
+
+  ContinueAsyncRead(std::make_shared<AsyncRead>(sha1_key, fd, data_offset,
+        data_size, std::move(callback)));
+}
+
+// reads the rest of the data, short reads are followed by more reads
+void DiskCache::ContinueAsyncRead(std::shared_ptr<AsyncRead> read) {
+  if (read->done == read->data.size()) {
+    ::close(read->fd);
+    read->callback(true, std::move(read->data));
+    return;
+  }
+
+  GetIoEngine().Read(read->fd, &read->data[read->done],
+      read->data.size() - read->done, read->offset + read->done,
+      [this, read](long result) {
+        if (result == -EINTR || result == -EAGAIN) {
+          result = 0;
+        } else if (result <= 0) {
+          LOG_E("lru::DiskCache", "failed to read entry: %s",
+              Sha1KeyToHex(read->sha1_key).c_str());
+          ::close(read->fd);
+          read->callback(false, std::string());
+          return;
+        }
+
+        read->done += result;
+        ContinueAsyncRead(read);
       });
+}
+
+void DiskCache::PutAsync(const std::string &key, std::string data,
+    PutAsyncFun &&callback) {
+  if (key.size() == 0) {
+    LOG_E("lru::DiskCache", "key is empty");
+    callback(false);
+    return;
+  }
+
+  std::string sha1_key = HashKey(key);
+  Shard &shard = GetShard(sha1_key);
+
+  // appending to a segment is a single buffered write
+  if (packed_max_size_ > 0 &&
+      static_cast<long>(data.size()) <= packed_max_size_) {
+    callback(PutBuffer(shard, sha1_key, data.data(), data.size()));
+    return;
+  }
+
+  std::string tmp_file;
+  int fd = OpenTmpFile(sha1_key, &tmp_file);
+  if (fd < 0) {
+    callback(false);
+    return;
+  }
+
+  ContinueAsyncWrite(std::make_shared<AsyncWrite>(&shard, sha1_key, tmp_file,
+        fd, std::move(data), std::move(callback)));
+}
+
+// writes the rest of the data, and commits the entry once it is all written
+void DiskCache::ContinueAsyncWrite(std::shared_ptr<AsyncWrite> write) {
+  if (write->done == write->data.size()) {
+    ::close(write->fd);
+
+    // committing may wait for the shard lock and its initialization, which
+    // must not hold up the completions of the engine, nor may the callback
+    // hold up the actions of the shard
+    EnqueueAction(*write->shard, [this, write]{
+      bool ok = CommitEntry(*write->shard, write->sha1_key, write->tmp_file,
+          write->data.size(), -1, 0);
+      callback_pool_->Run([write, ok]{ write->callback(ok); });
+    });
+    return;
+  }
+
+  GetIoEngine().Write(write->fd, &write->data[write->done],
+      write->data.size() - write->done, write->done,
+      [this, write](long result) {
+        if (result == -EINTR || result == -EAGAIN) {
+          result = 0;
+        } else if (result <= 0) {
+          LOG_E("lru::DiskCache", "writing to file failed: %s",
+              write->tmp_file.c_str());
+          ::close(write->fd);
+          ::unlink(write->tmp_file.c_str());
+          write->callback(false);
+          return;
+        }
+
+        write->done += result;
+        ContinueAsyncWrite(write);
+      });
+}
+
+bool DiskCache::UsesIoUring() {
+  return GetIoEngine().UsesIoUring();
+}
+
+IoEngine &DiskCache::GetIoEngine() {
+  std::call_once(io_engine_once_, [this]{
+    io_engine_.reset(new IoEngine(std::max(io_queue_depth_, 1),
+          std::max(io_thread_count_, 1), use_io_uring_));
+    callback_pool_.reset(new ThreadPool(1));
+    LOG_D("lru::DiskCache", "async I/O through %s",
+        io_engine_->UsesIoUring() ? "io_uring" : "threads");
+  });
+  return *io_engine_;
+}
+
+void DiskCache::Remove(const std::string &key) {
+  std::string sha1_key = HashKey(key);
+  RemoveWithLocking(GetShard(sha1_key), sha1_key);
+}
+
+void DiskCache::RemoveBatch(const std::vector<std::string> &keys) {
+  std::vector<std::vector<std::string>> by_shard(shards_.size());
+  for (auto &key : keys) {
+    std::string sha1_key = HashKey(key);
+    by_shard[GetShard(sha1_key).index].push_back(std::move(sha1_key));
+  }
+
+  for (auto &shard : shards_) {
+    if (!by_shard[shard->index].empty()) {
+      RemoveEntries(*shard, by_shard[shard->index]);
     }
+  }
+}
+
+// the same as RemoveWithLocking() for all |sha1_keys| of a shard, under a
+// single lock and with a single action
+void DiskCache::RemoveEntries(Shard &shard,
+    const std::vector<std::string> &sha1_keys) {
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  if (!WaitForInitialization(shard, lock)) {
+    for (auto &sha1_key : sha1_keys) {
+      file_reaper_->Dispose(GetCacheFile(sha1_key));
+      shard.pending_ops.emplace_back(Journal::ACTION_DELETE, sha1_key, 0);
+    }
+    return;
+  }
+
+  // the keys removed and whether they have a file of their own
+  std::vector<std::pair<std::string, bool>> removed;
+  for (auto &sha1_key : sha1_keys) {
+    EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+    if (handle != EntryIndex::INVALID_HANDLE) {
+      removed.emplace_back(sha1_key,
+          shard.entries.ValueOf(handle).segment < 0);
+      EraseEntry(shard, handle);
+    }
+  }
 
+  if (removed.empty()) {
+    return;
+  }
+
+  EnqueueAction(shard, [this, &shard, removed]{
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      // the same as RemoveWithoutLocking(), keys put again are kept
+      for (auto &entry : removed) {
+        if (shard.entries.Find(Sha1Key(entry.first)) ==
+            EntryIndex::INVALID_HANDLE) {
+          DeleteCacheFileAndWriteJournal(shard, entry.first, entry.second);
+        }
+      }
+    }
+
+    CompactSegmentsIfNeeded(shard);
+  });
+}
+
+bool DiskCache::RemoveWithLocking(Shard &shard, const std::string &sha1_key) {
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  if (!WaitForInitialization(shard, lock)) {
+    file_reaper_->Dispose(GetCacheFile(sha1_key));
+    shard.pending_ops.emplace_back(Journal::ACTION_DELETE, sha1_key, 0);
     return true;
   }
 
-  return false;
+  return RemoveWithoutLocking(shard, sha1_key, false);
 }
 
-void DiskCache::DeleteCacheFileAndWriteJournal(const std::string &sha1_key, 
-    EntryIterator iter) {
+bool DiskCache::RemoveWithoutLocking(Shard &shard,
+    const std::string &sha1_key, bool in_background) {
+  EntryHandle handle = shard.entries.Find(Sha1Key(sha1_key));
+  if (handle == EntryIndex::INVALID_HANDLE) {
+    return false;
+  }
+
+  LOG_V("lru::DiskCache", ">>>>> removing... %s",
+      Sha1KeyToHex(sha1_key).c_str());
 
-  // delete the cache file
-  FileUtil::DeleteFile(GetCacheFile(sha1_key));
+  bool has_file = shard.entries.ValueOf(handle).segment < 0;
+  EraseEntry(shard, handle);
 
-  // write a log to the journal
-  journal_ofstream_ << ACTION_DELETE << ' ' << sha1_key << std::endl;
-  ++redundant_count_;
+  if (in_background) {
+    DeleteCacheFileAndWriteJournal(shard, sha1_key, has_file);
+  } else {
+    EnqueueAction(shard, [this, &shard, sha1_key, has_file]{
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        // the key may have been put again before this action runs, the new
+        // file must be kept then
+        if (shard.entries.Find(Sha1Key(sha1_key)) ==
+            EntryIndex::INVALID_HANDLE) {
+          DeleteCacheFileAndWriteJournal(shard, sha1_key, has_file);
+        }
+      }
 
-  cur_cache_size_ -= iter->second->second;
-  entry_map_.erase(iter);
-  entry_list_.erase(iter->second); 
+      CompactSegmentsIfNeeded(shard);
+    });
+  }
 
-  CompactJournalIfNeeded(false, false);
+  return true;
 }
 
-void DiskCache::CompactJournalIfNeeded(bool should_lock, bool force) {
-  if (!force && redundant_count_ < COMPACT_THRESHOLD) {
-    return;
+void DiskCache::EraseEntry(Shard &shard, EntryHandle handle) {
+  const Entry &entry = shard.entries.ValueOf(handle);
+  shard.cache_size -= entry.size;
+  cur_cache_size_ -= entry.size;
+  --cur_item_count_;
+
+  // the space of a packed entry is reclaimed by compacting its segment
+  if (entry.segment >= 0) {
+    shard.segments->RemoveLive(entry.segment, entry.size);
   }
 
-  LOG_V("lru::DiskCache", "compact journal: %d, %d, %d", 
-      force, redundant_count_, COMPACT_THRESHOLD);
+  shard.evictor->OnErase(handle);
+  shard.entries.Erase(handle);
+}
 
-  std::string jn_file(cache_dir_ + JOURNAL_FILE);
-  std::string tmp_jn_file(jn_file + ".tmp");
+void DiskCache::DeleteCacheFileAndWriteJournal(Shard &shard,
+    const std::string &sha1_key, bool has_file) {
 
-  std::ofstream tmp_jn(tmp_jn_file, std::ios::binary);
+  // delete the cache file
+  if (has_file) {
+    file_reaper_->Dispose(GetCacheFile(sha1_key));
+  }
 
-  tmp_jn << MAGIC_STRING << LINE_FEED;
-  tmp_jn << VERSION << LINE_FEED;
-  tmp_jn << app_version_ << LINE_FEED;
-  tmp_jn << LINE_FEED;
+  // write a log to the journal
+  shard.journal->Append(Journal::ACTION_DELETE, sha1_key, 0);
+  ++shard.redundant_count;
+}
 
-  std::unique_lock<std::mutex> lock;
-  if (should_lock) {
-    lock = std::unique_lock<std::mutex>(mutex_);
+// runs on |action_thread| without holding the lock. the entries are
+// written in chunks from the least recently used one, each chunk is copied
+// while the shard is locked and written after unlocking, and the chunks
+// are written by queued actions, so other actions of the shard run in
+// between. the walk is marked by |journal_cursor|, a marker node in
+// |entries| that is moved towards the front past every chunk. an entry
+// that changes meanwhile has its record appended to the journal, which
+// keeps such records and puts them after the rewritten ones on committing.
+// |force| writes all chunks at once, which is meant for initialization
+void DiskCache::CompactJournalIfNeeded(Shard &shard, bool force) {
+  if (shard.compacting_journal ||
+      (!force && shard.redundant_count < COMPACT_THRESHOLD)) {
+    return;
   }
 
-  for (auto it = entry_list_.begin(); it != entry_list_.end(); ++it) {
-    tmp_jn << ACTION_UPDATE << ' ';
-    tmp_jn << it->first << ' ';
-    tmp_jn << it->second << LINE_FEED;
+  LOG_V("lru::DiskCache", "compact journal: %d, %d, %d", 
+      force, shard.redundant_count, COMPACT_THRESHOLD);
+
+  if (!shard.journal->BeginRewrite()) {
+    return;
   }
-  tmp_jn.close();
 
-  if (journal_ofstream_.is_open()) {
-    journal_ofstream_.close();
-    LOG_D("lru::DiskCache", "close original journal file");
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.journal_cursor = shard.entries.PushBackMarker(Entry());
+    shard.compacting_journal = true;
+
+    // the order of all entries is journaled by the rewrite
+    ++shard.read_epoch;
+    shard.read_epoch_start = std::chrono::steady_clock::now();
   }
 
-  std::string bak_jn_file(jn_file + ".bak");
+  shard.redundant_count = 0;
+
+  WriteJournalChunks(shard, force);
+}
+
+// writes the next chunk of the running journal compaction, or all of them,
+// and commits the new journal after the last one
+void DiskCache::WriteJournalChunks(Shard &shard, bool all) {
+  bool done;
+  do {
+    shard.journal_chunk.clear();
+    {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+
+      // replaying moves every updated entry to the front, so write from the
+      // least recently used entry to get the same order back
+      EntryHandle handle = shard.journal_cursor;
+      while (shard.entries.Prev(handle) != EntryIndex::INVALID_HANDLE &&
+          shard.journal_chunk.size() < COMPACT_CHUNK_SIZE) {
+        handle = shard.entries.Prev(handle);
+        if (!shard.evictor->IsMarker(handle)) {
+          shard.journal_chunk.push_back(SnapshotEntry{
+              shard.entries.KeyOf(handle), shard.entries.ValueOf(handle)});
+        }
+      }
+
+      shard.entries.MoveBefore(shard.journal_cursor, handle);
+      done = shard.entries.Prev(shard.journal_cursor) ==
+        EntryIndex::INVALID_HANDLE;
+      if (done) {
+        shard.entries.Erase(shard.journal_cursor);
+        shard.journal_cursor = EntryIndex::INVALID_HANDLE;
+        shard.compacting_journal = false;
+      }
+    }
 
-  // rename original to bak
-  if (FileUtil::FileExists(jn_file)) {
-    FileUtil::DeleteFile(bak_jn_file);
-    std::rename(jn_file.c_str(), bak_jn_file.c_str());
+    std::string sha1_key;
+    for (auto &snapshot : shard.journal_chunk) {
+      const Entry &entry = snapshot.entry;
+      sha1_key.assign(snapshot.sha1_key.data, sizeof(snapshot.sha1_key.data));
+      shard.journal->Rewrite(Journal::ACTION_UPDATE, sha1_key, entry.size,
+          entry.segment, entry.offset);
+      if (shard.evictor->ShouldJournalRegion(entry.region)) {
+        shard.journal->Rewrite(Journal::ACTION_REGION, sha1_key,
+            entry.region);
+      }
+    }
+  } while (all && !done);
 
-    LOG_D("lru::DiskCache", "backup original journal file");
+  if (!done) {
+    EnqueueAction(shard, [this, &shard]{ WriteJournalChunks(shard, false); });
+    return;
   }
 
-  // rename tmp to original 
-  if (std::rename(tmp_jn_file.c_str(), jn_file.c_str()) == 0) {
-    FileUtil::DeleteFile(bak_jn_file);
+  shard.journal->CommitRewrite();
+}
 
-    LOG_D("lru::DiskCache", "rename tmp journal file to original journal file");
-    LOG_D("lru::DiskCache", "%s -> %s", tmp_jn_file.c_str(), jn_file.c_str());
+// copies the live entries of a segment whose live ratio dropped below the
+// threshold to the active segment and deletes it, runs on |action_thread|
+void DiskCache::CompactSegmentsIfNeeded(Shard &shard) {
+  int segment = shard.segments->PickSegmentToCompact(segment_compact_ratio_);
+  if (segment < 0) {
+    return;
   }
 
-  redundant_count_ = 0;
+  // only the entries put in the segment are looked up, the stale
+  // positions among them are dropped on the way
+  std::vector<SnapshotEntry> entries;
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto iter = shard.segment_entries.find(segment);
+    if (iter != shard.segment_entries.end()) {
+      auto &positions = iter->second;
+      std::size_t live_count = 0;
+      for (auto &position : positions) {
+        EntryHandle handle = shard.entries.Find(position.first);
+        if (handle != EntryIndex::INVALID_HANDLE &&
+            shard.entries.ValueOf(handle).segment == segment &&
+            shard.entries.ValueOf(handle).offset == position.second) {
+          entries.push_back(SnapshotEntry{
+              position.first, shard.entries.ValueOf(handle)});
+          positions[live_count++] = position;
+        }
+      }
+      positions.resize(live_count);
+    }
+  }
+
+  LOG_D("lru::DiskCache", "compact segment %d of shard %d, live entries=%zd",
+      segment, shard.index, entries.size());
+
+  std::string file = shard.segments->GetSegmentFile(segment);
+  int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0 && !entries.empty()) {
+    LOG_E("lru::DiskCache", "failed to open segment %s", file.c_str());
+  }
+
+  std::string data;
+  for (auto &snapshot : entries) {
+    const Entry &entry = snapshot.entry;
+    std::string sha1_key = snapshot.sha1_key.ToString();
+    data.resize(entry.size);
+    int new_segment = -1;
+    long new_offset = 0;
+    bool copied = fd >= 0 &&
+      ::pread(fd, &data[0], entry.size, entry.offset) == entry.size &&
+      shard.segments->Append(data.data(), entry.size, &new_segment,
+          &new_offset);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (copied) {
+      // the copy is live or dead once the lock is released
+      shard.segments->Unpin(new_segment);
+    }
+
+    // skip the entry if it was overwritten or removed in the meantime
+    EntryHandle handle = shard.entries.Find(snapshot.sha1_key);
+    if (handle == EntryIndex::INVALID_HANDLE ||
+        shard.entries.ValueOf(handle).segment != segment ||
+        shard.entries.ValueOf(handle).offset != entry.offset) {
+      continue;
+    }
+
+    if (!copied) {
+      RemoveWithoutLocking(shard, sha1_key, true);
+      continue;
+    }
+
+    HandleRecordForMove(shard, sha1_key, new_segment, new_offset);
+
+    // queued behind the records of all changes made to the index so far
+    long size = entry.size;
+    EnqueueAction(shard, [&shard, sha1_key, size, new_segment, new_offset]{
+      shard.journal->Append(Journal::ACTION_MOVE, sha1_key, size,
+          new_segment, new_offset);
+    });
+  }
 
-  journal_ofstream_.open(jn_file, std::ios::binary | std::ios::app);
-  if (lock.owns_lock()) {
-    lock.unlock();
+  if (fd >= 0) {
+    ::close(fd);
   }
-  cond_.notify_all();
 
-  LOG_V("lru::DiskCache", "journal opened");
+  // the segment goes away after the records moving its entries out, it is
+  // kept if a Put committed an entry to it meanwhile
+  EnqueueAction(shard, [&shard, segment]{
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (shard.segments->DeleteSegmentIfDead(segment)) {
+      shard.segment_entries.erase(segment);
+    }
+  });
+}
+
+// the digest fills the key up to the digest size of the hasher, the rest
+// is zero
+std::string DiskCache::HashKey(const std::string &key) const {
+  unsigned char digest[KeyHasher::MAX_DIGEST_SIZE] = { 0 };
+  key_hasher_.hash(key.data(), key.size(), digest);
+  return std::string(reinterpret_cast<char *>(digest), sizeof(digest));
 }
 
+// <cache_dir>/<first 2 hex digits>/<remaining hex digits> of the digest
 std::string DiskCache::GetCacheFile(const std::string &sha1_key) const {
-  std::string file(cache_dir_);
-  file.append(1, '/')
-  .append(sha1_key.c_str(), 2)
-  .append(1, '/')
-  .append(sha1_key.c_str() + 2);
+  std::string file;
+  file.reserve(cache_dir_.size() + 2 + key_hasher_.digest_size * 2);
+  file.append(cache_dir_);
+  for (int i = 0; i < key_hasher_.digest_size; ++i) {
+    if (i < 2) {
+      file.append(1, '/');
+    }
+    unsigned char c = static_cast<unsigned char>(sha1_key[i]);
+    file.append(1, HEX_DIGITS[c >> 4]);
+    file.append(1, HEX_DIGITS[c & 0xf]);
+  }
 
   return file;
 }
 
-void DiskCache::EnqueueAction(std::function<void()> &&action) {
-  action_queue_.ForwardPushBack(std::forward<std::function<void()>>(action));
+DiskCache::Shard &DiskCache::GetShard(const std::string &sha1_key) {
+  if (shards_.size() == 1) {
+    return *shards_[0];
+  }
+
+  // the same prefix names the subdirectory in GetCacheFile(), so a
+  // subdirectory is always owned by exactly one shard
+  int prefix = static_cast<unsigned char>(sha1_key[0]);
+  return *shards_[prefix % shards_.size()];
 }
 
-void DiskCache::RunQueuedActions() {
-  while (action_queue_.HasNext()) {
-    action_queue_.Front()();
-    action_queue_.PopFront();
+// in warm-start mode, returns false right away if the journal of |shard| is
+// still being replayed
+bool DiskCache::WaitForInitialization(Shard &shard,
+    std::unique_lock<std::mutex> &lock) {
+  if (warm_start_ && !shard.initialized) {
+    return false;
+  }
+
+  shard.cond.wait(lock, [&shard]{ return shard.initialized.load(); });
+  return true;
+}
+
+void DiskCache::EnqueueAction(Shard &shard, std::function<void()> &&action) {
+  shard.action_queue.ForwardPushBack(
+      std::forward<std::function<void()>>(action));
+}
+
+Journal::Stats DiskCache::JournalStats() const {
+  Journal::Stats stats;
+  for (auto &shard : shards_) {
+    Journal::Stats shard_stats = shard->journal->GetStats();
+    stats.record_count += shard_stats.record_count;
+    stats.flush_count += shard_stats.flush_count;
+    stats.sync_count += shard_stats.sync_count;
+    stats.rewrite_count += shard_stats.rewrite_count;
+  }
+  return stats;
+}
+
+void DiskCache::RunQueuedActions(Shard &shard) {
+  while (true) {
+    if (!shard.action_queue.HasNext(0)) {
+      // out of work, wait for more, or until the buffered journal records
+      // are due to be written or the written ones to be synced. whatever
+      // is left is written when the journal is closed
+      int wait_time = shard.journal->MillisUntilDue();
+      if (!shard.action_queue.HasNext(wait_time)) {
+        if (!shard.action_queue.IsRunning()) {
+          break;
+        }
+        shard.journal->FlushIfDue();
+        continue;
+      }
+    }
+
+    shard.action_queue.Front()();
+    shard.action_queue.PopFront();
+
+    CompactJournalIfNeeded(shard, false);
   }
 
-  LOG_D("lru::DiskCache", "quit action queue.");
+  LOG_D("lru::DiskCache", "quit action queue of shard %d.", shard.index);
 }
 
 };  // namespace lru
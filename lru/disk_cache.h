@@ -8,13 +8,32 @@
 #define DISK_CACHE_H_
 #include <string>
 #include <fstream>
-#include <map>
-#include <list>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <unordered_map>
 #include <mutex>
 #include <thread>
 #include <condition_variable>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#endif
 #include "common/blocking_queue.h"
+#include "common/io_engine.h"
+#include "common/mapped_file.h"
+#include "common/thread_pool.h"
+#include "lru/evictor.h"
+#include "lru/file_reaper.h"
+#include "lru/journal.h"
+#include "lru/key_hasher.h"
+#include "lru/lru_index.h"
+#include "lru/segment_store.h"
 
 namespace lru {
 
@@ -22,68 +41,605 @@ class DiskCache {
  public:
    using WriteCacheDataFun = std::function<bool(std::ofstream &)>;
    using ReadCacheDataFun = std::function<bool(std::ifstream &)>;
+   using ReadStreamFun = std::function<bool(std::istream &)>;
+   using LoadFun = std::function<bool(std::string *data)>;
+   using GetAsyncFun = std::function<void(bool found, std::string &&data)>;
+   using PutAsyncFun = std::function<void(bool ok)>;
+
+   struct Options {
+     // number of independent shards, each shard owns its own index, journal
+     // and background thread. keys are routed to shards by the first byte of
+     // their digest, so at most 256 shards are used, and the number must stay
+     // the same across runs for the same cache_dir
+     int shard_count;
+
+     // serve requests while the journal is still being replayed instead of
+     // blocking them until the cache is initialized. reads go straight to
+     // the cache file, writes and removals update the files at once and
+     // reach the index and the journal when replaying is done
+     bool warm_start;
+
+     // values of at most this many bytes written through the buffer Put()
+     // are appended to shared segment files instead of getting a file of
+     // their own, 0 disables packing. packed entries are not served by reads
+     // in warm-start mode before replaying is done
+     long packed_max_size;
+
+     // a segment is sealed once appending to it would exceed this size
+     long segment_size;
+
+     // a sealed segment whose live bytes drop below this ratio of its size
+     // gets compacted in the background, its live entries are copied to the
+     // active segment and the file is deleted
+     float segment_compact_ratio;
+
+     // how the journal records of every shard are batched and synced
+     Journal::FlushPolicy journal_flush;
+
+     // a read always promotes the entry in memory, but only the first read
+     // of an entry within every epoch of this many milliseconds is
+     // journaled, so the LRU order survives restarts at the granularity of
+     // epochs. 0 journals every read
+     int read_journal_epoch_ms;
+
+     // turns keys into the digests entries are indexed and named by. a
+     // cache_dir reopened with another hasher starts out empty, the journal
+     // written with the old one is discarded
+     KeyHasher key_hasher;
+
+     // which entries are evicted when the cache is full, see EvictionPolicy.
+     // every shard evicts on its own, with its own frequency sketch for
+     // TINY_LFU and ghost lists for ARC. the regions entries are in are
+     // journaled when the journal is rewritten, the ghost lists are not
+     EvictionPolicy eviction_policy;
+
+     // eviction starts once the cache size or the item count exceeds this
+     // ratio of its limit, and goes on until both are below
+     // |eviction_low_watermark| of their limits
+     float eviction_high_watermark;
+     float eviction_low_watermark;
+
+     // every shard evicts on its background thread in batches of about
+     // this many microseconds, the other actions of the shard run in
+     // between. 0 evicts down to the low watermark in a single batch. if
+     // entries are put faster than that, a cache beyond its limits by more
+     // than the band between the watermarks is trimmed back to the limits
+     // on every Put
+     int eviction_batch_us;
+
+     // cache files and segments being deleted are moved into a trash
+     // directory in cache_dir and deleted there by this many threads shared
+     // by all shards, so a large file does not hold up the shard while its
+     // blocks are freed. 0 deletes them on the spot
+     int unlink_thread_count;
+
+     // GetBatch() and PutBatch() read and write the data of their entries
+     // on the calling thread and this many threads shared by all shards
+     int io_thread_count;
+
+     // GetAsync() and PutAsync() read and write the data of their entries
+     // through io_uring with at most |io_queue_depth| operations in flight
+     // if |use_io_uring| and the kernel supports it, otherwise through
+     // max(|io_thread_count|, 1) threads of their own. either is set up by
+     // the first of them called. opening, renaming and deleting the cache
+     // files, and the journal, are still done with plain system calls
+     bool use_io_uring;
+     int io_queue_depth;
+
+     Options() : shard_count(1), warm_start(false), packed_max_size(0),
+       segment_size(64 * 1024 * 1024), segment_compact_ratio(0.5f),
+       read_journal_epoch_ms(0), key_hasher(SHA1_KEY_HASHER),
+       eviction_policy(EvictionPolicy::LRU), eviction_high_watermark(1.0f),
+       eviction_low_watermark(0.95f), eviction_batch_us(1000),
+       unlink_thread_count(1), io_thread_count(0), use_io_uring(true),
+       io_queue_depth(64) { }
+   };
 
    DiskCache(const std::string &cache_dir, int app_version, 
        long max_cache_size, long max_item_count);
+   DiskCache(const std::string &cache_dir, int app_version, 
+       long max_cache_size, long max_item_count, const Options &options);
    ~DiskCache();
 
  public:
    bool Put(const std::string &key, WriteCacheDataFun &&fun);
+   // writes |data| with a single open/write/rename, cheaper than the
+   // callback version above for small values. values small enough are
+   // packed into segment files, see Options
+   bool Put(const std::string &key, const void *data, std::size_t len);
+#if __cplusplus >= 201703L
+   bool Put(const std::string &key, std::string_view data) {
+     return Put(key, data.data(), data.size());
+   }
+#endif
+   // packed entries have no file of their own to open an ifstream on,
+   // Get() misses them, GetStream() reads them through an istream over a
+   // copy of their data, and the others through an ifstream of their file
    bool Get(const std::string &key, ReadCacheDataFun &&fun);
+   bool GetStream(const std::string &key, ReadStreamFun &&fun);
+   // returns a read-only mapping of the cached data, or nullptr on miss.
+   // the mapping pins the file it was made from, so it stays valid and
+   // unchanged even if the entry is evicted or overwritten afterwards
+   std::shared_ptr<const MappedFile> GetMapped(const std::string &key);
+   // copies |length| bytes (all the remaining bytes if negative) of the
+   // cached data from |offset| to |out_fd| with sendfile(2), the data never
+   // enters user space. returns the number of bytes written, which is less
+   // than requested if |out_fd| is non-blocking and would block, or -1 on
+   // miss or error
+   long GetToFd(const std::string &key, int out_fd, long offset = 0,
+       long length = -1);
+   // reads the cached data of |key| into |data|, on a miss |loader| makes
+   // the data, which is then put. concurrent calls for the same key share
+   // a single call of the loader, the others wait for its result. returns
+   // false if the loader fails
+   bool GetOrLoad(const std::string &key, std::string *data,
+       LoadFun &&loader);
    void Remove(const std::string &key);
+
+   // batch versions of Get(), Put() and Remove(). the keys are hashed up
+   // front, and every shard involved is locked once and journals its part
+   // of the batch with a single action. the results are in the order of
+   // the keys, a value is empty for a key not found. Puts in a batch are
+   // not coalesced with other Puts of their keys
+   std::vector<bool> GetBatch(const std::vector<std::string> &keys,
+       std::vector<std::string> *values);
+   std::vector<bool> PutBatch(
+       const std::vector<std::pair<std::string, std::string>> &entries);
+   void RemoveBatch(const std::vector<std::string> &keys);
+
+   // asynchronous versions of Get() and Put() for byte strings, they return
+   // once the entry is looked up or the file is created, the data is read
+   // or written by the I/O engine. |callback| is called on the calling
+   // thread for a miss, an error, or a PutAsync() of a packed entry, which
+   // is written at once. otherwise GetAsync() calls it on a thread of the
+   // I/O engine, and PutAsync() on a callback thread of the cache once the
+   // entry is committed. PutAsync() is not coalesced with other Puts of its
+   // key, the last one to finish wins
+   void GetAsync(const std::string &key, GetAsyncFun &&callback);
+   void PutAsync(const std::string &key, std::string data,
+       PutAsyncFun &&callback);
+   // whether GetAsync() and PutAsync() read and write through io_uring
+   bool UsesIoUring();
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+   // co_await cache.GetAsync(key) gives the data, or nullopt on a miss,
+   // co_await cache.PutAsync(key, data) gives whether the entry was put.
+   // they are the callback versions above, so nothing blocks a thread
+   // while the data is read or written, and the coroutine resumes on the
+   // thread that calls the callback, a thread of the I/O engine or the
+   // callback thread, where it should not block for long. it goes on
+   // without suspending if the callback is called right away
+   class GetAwaiter;
+   class PutAwaiter;
+
+   GetAwaiter GetAsync(const std::string &key);
+   PutAwaiter PutAsync(const std::string &key, std::string data);
+#endif
    inline bool IsInitialized() const;
    inline long ItemCount() const;
    inline long MaxItemCount() const;
    inline long CurrentCacheSize() const;
    inline long MaxCacheSize() const;
+   inline int ShardCount() const;
+   // journal counters summed across all shards, record_count / flush_count
+   // is the average number of records written per batch
+   Journal::Stats JournalStats() const;
 
  private:
-   using ListElement = std::pair<std::string, long>;
-   using EntryIterator = std::map<std::string, std::list<ListElement>::iterator>::iterator;
-   std::map<std::string, std::list<ListElement>::iterator> entry_map_;
-   std::list<ListElement> entry_list_;
-   
+   // the digest of a key as stored in the index, zero-padded to 20 bytes.
+   // the strings passed around elsewhere hold the same bytes
+   struct Sha1Key {
+     char data[20];
+
+     Sha1Key() : data() { }
+     explicit Sha1Key(const std::string &sha1_key);
+     std::string ToString() const { return std::string(data, sizeof(data)); }
+     bool operator==(const Sha1Key &other) const;
+   };
+
+   // the digest is uniformly distributed already, the bytes after the
+   // first one are used because the first byte routes keys to shards
+   struct Sha1KeyHash {
+     std::size_t operator()(const Sha1Key &key) const;
+   };
+
+   // the size of the cached data. a packed entry lives at |offset| in
+   // |segment| of the shard's segment store, |segment| is -1 for an entry
+   // stored in a file of its own. |read_epoch| is the read epoch of the
+   // shard in which the position of the entry was last journaled, |region|
+   // belongs to the evictor of the shard
+   struct Entry {
+     long size;
+     long offset;
+     int segment;
+     unsigned read_epoch;
+     unsigned char region;
+
+     Entry() : size(0), offset(0), segment(-1), read_epoch(0), region(0) { }
+     Entry(long size, int segment, long offset) :
+       size(size), offset(offset), segment(segment), read_epoch(0),
+       region(0) { }
+   };
+   using EntryIndex = LruIndex<Sha1Key, Entry, Sha1KeyHash>;
+   using EntryHandle = EntryIndex::Handle;
+   using EntryEvictor = Evictor<EntryIndex, Sha1KeyHash>;
+
+   // an operation that arrived while the journal was being replayed, the
+   // action is one of the Journal actions
+   struct PendingOp {
+     char action;
+     std::string sha1_key;
+     long size;
+     int segment;
+     long offset;
+
+     PendingOp(char action, const std::string &sha1_key, long size,
+         int segment = -1, long offset = 0) :
+       action(action), sha1_key(sha1_key), size(size), segment(segment),
+       offset(offset) { }
+   };
+
+   // an entry copied out of the index along with its key
+   struct SnapshotEntry {
+     Sha1Key sha1_key;
+     Entry entry;
+   };
+
+   // an entry of a GetBatch() at |index| of the keys, opened for reading
+   // as |fd|, |offset| is -1 for a file of its own
+   struct BatchRead {
+     std::size_t index;
+     std::string sha1_key;
+     int fd;
+     long offset;
+     long size;
+
+     BatchRead(std::size_t index, const std::string &sha1_key) :
+       index(index), sha1_key(sha1_key), fd(-1), offset(-1), size(0) { }
+   };
+
+   // an entry of a PutBatch() as written by WriteBuffer()
+   struct BatchWrite {
+     std::string sha1_key;
+     std::string tmp_file;
+     long size;
+     int segment;
+     long offset;
+     bool ok;
+
+     BatchWrite() : size(0), segment(-1), offset(0), ok(false) { }
+   };
+
+   // an entry put in the index, to be journaled by JournalUpdate()
+   struct IndexUpdate {
+     std::string sha1_key;
+     long size;
+     int segment;
+     long offset;
+     bool replaced;
+     // the entry had a file of its own and has been packed
+     bool drop_file;
+     // |region| is journaled as well, see PromoteEntry()
+     bool promoted;
+     unsigned char region;
+
+     IndexUpdate(const std::string &sha1_key, long size, int segment,
+         long offset) :
+       sha1_key(sha1_key), size(size), segment(segment), offset(offset),
+       replaced(false), drop_file(false), promoted(false), region(0) { }
+   };
+
+   // a GetAsync() in progress, |done| bytes of |data| have been read from
+   // |offset| of |fd|
+   struct AsyncRead {
+     std::string sha1_key;
+     int fd;
+     long offset;
+     std::size_t done;
+     std::string data;
+     GetAsyncFun callback;
+
+     AsyncRead(const std::string &sha1_key, int fd, long offset, long size,
+         GetAsyncFun &&callback) :
+       sha1_key(sha1_key), fd(fd), offset(offset), done(0), data(size, '\0'),
+       callback(std::move(callback)) { }
+   };
+
+   // a GetOrLoad() running the loader of a key, |data| is only filled in
+   // for the callers waiting for it
+   struct LoadFlight {
+     bool done;
+     bool ok;
+     std::string data;
+
+     LoadFlight() : done(false), ok(false) { }
+   };
+
+   // the Puts of a key waiting for the one writing it. every Put replaces
+   // |write| with its own, the first of them to wake up after the writer
+   // is done writes the latest data, and all of them share the result
+   struct CoalescedPuts {
+     std::function<bool()> write;
+     bool done;
+     bool result;
+
+     CoalescedPuts() : done(false), result(false) { }
+   };
+
+   struct PutFlight {
+     bool writing;
+     std::shared_ptr<CoalescedPuts> next;
+
+     PutFlight() : writing(false) { }
+   };
+
+   // all fields except the journal and the flights are guarded by |mutex|,
+   // the journal and |redundant_count| are only touched on |action_thread|
+   struct Shard {
+     int index;
+
+     // most recently used entries first, ordered by |evictor|
+     EntryIndex entries;
+     std::unique_ptr<EntryEvictor> evictor;
+     long cache_size;
+     int redundant_count;
+     std::atomic<bool> initialized;
+     std::atomic<bool> eviction_pending;
+     std::vector<PendingOp> pending_ops;
+     // where packed entries were put in every segment, so compacting a
+     // segment does not scan the index. positions left behind by entries
+     // moved, overwritten or removed since are dropped by the compaction
+     std::unordered_map<int, std::vector<std::pair<Sha1Key, long>>>
+       segment_entries;
+
+     // starts from 1 so that no entry is in the current epoch after a
+     // restart
+     unsigned read_epoch;
+     std::chrono::steady_clock::time_point read_epoch_start;
+
+     // a running journal compaction has written the entries behind
+     // |journal_cursor|, a marker in |entries|, see
+     // CompactJournalIfNeeded(). they are only changed on |action_thread|,
+     // |journal_chunk| is only touched there
+     bool compacting_journal;
+     EntryHandle journal_cursor;
+     std::vector<SnapshotEntry> journal_chunk;
+
+     std::unique_ptr<Journal> journal;
+     // null unless packing is enabled
+     std::unique_ptr<SegmentStore> segments;
+     BlockingQueue<std::function<void()>> action_queue;
+
+     std::thread action_thread;
+     std::mutex mutex;
+     std::condition_variable cond;
+
+     // by digest, guarded by |flight_mutex| rather than |mutex|, which the
+     // action thread holds often, and waited for on |flight_cond|
+     std::unordered_map<std::string, std::shared_ptr<LoadFlight>>
+       load_flights;
+     std::unordered_map<std::string, std::shared_ptr<PutFlight>> put_flights;
+     std::mutex flight_mutex;
+     std::condition_variable flight_cond;
+
+     Shard() : index(0), cache_size(0), redundant_count(0),
+       initialized(false), eviction_pending(false), read_epoch(1),
+       read_epoch_start(std::chrono::steady_clock::now()),
+       compacting_journal(false),
+       journal_cursor(EntryIndex::INVALID_HANDLE) { }
+   };
+
+   // a PutAsync() writing |data| to |tmp_file|
+   struct AsyncWrite {
+     Shard *shard;
+     std::string sha1_key;
+     std::string tmp_file;
+     int fd;
+     std::size_t done;
+     std::string data;
+     PutAsyncFun callback;
+
+     AsyncWrite(Shard *shard, const std::string &sha1_key,
+         const std::string &tmp_file, int fd, std::string &&data,
+         PutAsyncFun &&callback) :
+       shard(shard), sha1_key(sha1_key), tmp_file(tmp_file), fd(fd), done(0),
+       data(std::move(data)), callback(std::move(callback)) { }
+   };
+
+   // declared before |shards_| so that it outlives their segment stores
+   std::unique_ptr<FileReaper> file_reaper_;
+   std::unique_ptr<ThreadPool> io_pool_;
+   std::vector<std::unique_ptr<Shard>> shards_;
+   // created on first use, and destroyed first, its callbacks enqueue
+   // commits of entries to the shards
+   std::once_flag io_engine_once_;
+   std::unique_ptr<IoEngine> io_engine_;
+   // created along with |io_engine_| and destroyed after the action
+   // threads, calls the callbacks of PutAsync() after the commits, so that
+   // they never hold up an action thread
+   std::unique_ptr<ThreadPool> callback_pool_;
+
  private:
-   void InitFromJournal();
-   void ReadJournalFile(const std::string &jn_file, std::ifstream &jn_ifstream);
-   void HandleLineForUpdate(const std::string &sha1_key, long file_size);
-   void HandleLineForDelete(const std::string &sha1_key);
-   void HandleLineForRead(const std::string &sha1_key);
-
-   void EvictIfNeeded();
-   void CompactJournalIfNeeded(bool should_lock, bool force);
+   void InitFromJournal(Shard &shard);
+   void HandleRecordForUpdate(Shard &shard, const std::string &sha1_key,
+       long file_size, int segment, long offset);
+   void HandleRecordForMove(Shard &shard, const std::string &sha1_key,
+       int segment, long offset);
+   void HandleRecordForDelete(Shard &shard, const std::string &sha1_key);
+   void HandleRecordForRead(Shard &shard, const std::string &sha1_key);
+   void HandleRecordForRegion(Shard &shard, const std::string &sha1_key,
+       unsigned char region);
+   void ApplyPendingOps(Shard &shard);
+   bool PromoteEntry(Shard &shard, EntryHandle handle);
+   void JournalEntry(Shard &shard, const SnapshotEntry &snapshot);
+   void AddToSegment(Shard &shard, const std::string &sha1_key, int segment,
+       long offset, long size);
+   void RebuildSegmentEntries(Shard &shard);
+
+   void EvictIfNeeded(Shard &shard);
+   void ScheduleEvictionBatch(Shard &shard);
+   bool EvictEntries(Shard &shard, float watermark, bool timed);
+   void CompactJournalIfNeeded(Shard &shard, bool force);
+   void WriteJournalChunks(Shard &shard, bool all);
+   void CompactSegmentsIfNeeded(Shard &shard);
+   std::string HashKey(const std::string &key) const;
    std::string GetCacheFile(const std::string &sha1_key) const;
-   void EnqueueAction(std::function<void()> &&action);
+   // runs |write| unless a Put of the same key is being written, in which
+   // case it waits and is coalesced with the other Puts waiting
+   bool CoalescePut(Shard &shard, const std::string &sha1_key,
+       std::function<bool()> &&write);
+   bool PutFile(Shard &shard, const std::string &sha1_key,
+       WriteCacheDataFun &fun);
+   bool PutBuffer(Shard &shard, const std::string &sha1_key,
+       const void *data, std::size_t len);
+   bool WriteBuffer(Shard &shard, const std::string &sha1_key,
+       const void *data, std::size_t len, std::string *tmp_file,
+       int *segment, long *offset);
+   int OpenTmpFile(const std::string &sha1_key, std::string *tmp_file);
+   bool CommitEntry(Shard &shard, const std::string &sha1_key,
+       const std::string &tmp_file, long size, int segment, long offset);
+   void CommitEntries(Shard &shard, const std::vector<BatchWrite *> &writes);
+   IndexUpdate UpdateIndex(Shard &shard, const std::string &sha1_key,
+       long size, int segment, long offset);
+   void JournalUpdate(Shard &shard, const IndexUpdate &update);
+   // Get() with |file_fun|, GetStream() with |stream_fun|
+   bool ReadEntry(const std::string &key, ReadCacheDataFun *file_fun,
+       ReadStreamFun *stream_fun);
+   // |open_file| gets the file holding the data of the entry, |offset| is
+   // -1 if the whole file is the data, otherwise the data is the |size|
+   // bytes at |offset| of a segment
+   bool OpenCacheFileForRead(Shard &shard, const std::string &sha1_key,
+       const std::function<bool(const std::string &file, long offset,
+         long size)> &open_file);
+   void OpenCacheFilesForRead(Shard &shard, std::vector<BatchRead> *reads,
+       std::vector<BatchRead> *opened);
+   static bool ReadCacheFile(const BatchRead &read, std::string *data);
+   IoEngine &GetIoEngine();
+   void ContinueAsyncRead(std::shared_ptr<AsyncRead> read);
+   void ContinueAsyncWrite(std::shared_ptr<AsyncWrite> write);
+   bool ShouldJournalRead(Shard &shard, Entry &entry);
+   Shard &GetShard(const std::string &sha1_key);
+   bool WaitForInitialization(Shard &shard,
+       std::unique_lock<std::mutex> &lock);
+   void EnqueueAction(Shard &shard, std::function<void()> &&action);
 
-   bool RemoveWithLocking(const std::string &sha1_key);
-   bool RemoveWithoutLocking(const std::string &sha1_key, bool in_background);
-   void DeleteCacheFileAndWriteJournal(const std::string &sha1_key, 
-       EntryIterator iter);
+   bool RemoveWithLocking(Shard &shard, const std::string &sha1_key);
+   void RemoveEntries(Shard &shard, const std::vector<std::string> &sha1_keys);
+   bool RemoveWithoutLocking(Shard &shard, const std::string &sha1_key,
+       bool in_background);
+   void EraseEntry(Shard &shard, EntryHandle handle);
+   void DeleteCacheFileAndWriteJournal(Shard &shard,
+       const std::string &sha1_key, bool has_file);
 
-   void RunQueuedActions();
+   void RunQueuedActions(Shard &shard);
 
  private:
    std::string cache_dir_;
    long app_version_;
    long max_item_count_;
    long max_cache_size_;
-   long cur_cache_size_;
-   int redundant_count_;
+   bool warm_start_;
+   long packed_max_size_;
+   float segment_compact_ratio_;
+   int read_journal_epoch_ms_;
+   float eviction_high_watermark_;
+   float eviction_low_watermark_;
+   int eviction_batch_us_;
+   bool use_io_uring_;
+   int io_queue_depth_;
+   int io_thread_count_;
+   KeyHasher key_hasher_;
+   std::atomic<unsigned long> tmp_file_seq_;
+
+   // totals across all shards, the limits above apply to these
+   std::atomic<long> cur_cache_size_;
+   std::atomic<long> cur_item_count_;
+};
+
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+// whichever of the callback and await_suspend() comes second resumes the
+// coroutine, or tells it not to suspend
+class DiskCache::GetAwaiter {
+ public:
+   GetAwaiter(DiskCache *cache, const std::string &key) :
+     cache_(cache), key_(key), done_(false) { }
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> handle) {
+     handle_ = handle;
+     cache_->GetAsync(key_, [this](bool found, std::string &&data) {
+       if (found) {
+         result_ = std::move(data);
+       }
+       if (done_.exchange(true)) {
+         handle_.resume();
+       }
+     });
+     return !done_.exchange(true);
+   }
 
-   std::ofstream journal_ofstream_;
-   BlockingQueue<std::function<void()>> action_queue_;
+   std::optional<std::string> await_resume() { return std::move(result_); }
 
-   std::thread action_thread_;
-   std::mutex mutex_;
-   std::condition_variable cond_;
+ private:
+   DiskCache *cache_;
+   std::string key_;
+   std::coroutine_handle<> handle_;
+   std::atomic<bool> done_;
+   std::optional<std::string> result_;
 };
 
+class DiskCache::PutAwaiter {
+ public:
+   PutAwaiter(DiskCache *cache, const std::string &key, std::string data) :
+     cache_(cache), key_(key), data_(std::move(data)), done_(false),
+     result_(false) { }
+
+   bool await_ready() const noexcept { return false; }
+
+   bool await_suspend(std::coroutine_handle<> handle) {
+     handle_ = handle;
+     cache_->PutAsync(key_, std::move(data_), [this](bool ok) {
+       result_ = ok;
+       if (done_.exchange(true)) {
+         handle_.resume();
+       }
+     });
+     return !done_.exchange(true);
+   }
+
+   bool await_resume() const { return result_; }
+
+ private:
+   DiskCache *cache_;
+   std::string key_;
+   std::string data_;
+   std::coroutine_handle<> handle_;
+   std::atomic<bool> done_;
+   bool result_;
+};
+
+inline DiskCache::GetAwaiter DiskCache::GetAsync(const std::string &key) {
+  return GetAwaiter(this, key);
+}
+
+inline DiskCache::PutAwaiter DiskCache::PutAsync(const std::string &key,
+    std::string data) {
+  return PutAwaiter(this, key, std::move(data));
+}
+#endif
+
 bool DiskCache::IsInitialized() const {
-  return journal_ofstream_.is_open();
+  for (auto &shard : shards_) {
+    if (!shard->initialized) {
+      return false;
+    }
+  }
+  return true;
 }
 
 long DiskCache::ItemCount() const {
-  return entry_list_.size();
+  return cur_item_count_;
 }
 
 long DiskCache::MaxItemCount() const {
@@ -98,7 +654,10 @@ long DiskCache::MaxCacheSize() const {
   return max_cache_size_;
 }
 
+int DiskCache::ShardCount() const {
+  return shards_.size();
+}
+
 };  // namespace lru
 
 #endif /* end of include guard: DISK_CACHE_H_ */
-
@@ -0,0 +1,457 @@
+/*******************************************************************************
+**          File: evictor.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 12:46 AM
+**   Description: the order in which DiskCache and MemoryCache evict their
+**                entries
+*******************************************************************************/
+#ifndef EVICTOR_H_
+#define EVICTOR_H_
+#include <cstdint>
+#include "lru/frequency_sketch.h"
+#include "lru/lru_index.h"
+
+namespace lru {
+
+enum class EvictionPolicy {
+  // evicts the least recently used entry
+  LRU,
+  // W-TinyLFU, entries go through a small LRU window before they get into
+  // the main LRU list, and only if they are accessed more often than the
+  // entry they would push out of it, so a scan of keys used once does not
+  // flush the entries used over and over
+  TINY_LFU,
+  // segmented LRU, entries start out on probation and are protected once
+  // they are accessed again, 80% of the entries at most. probation is
+  // evicted first, protected entries beyond the 80% go back to probation
+  SLRU,
+  // adaptive replacement cache, entries start out on probation and are
+  // protected once they are accessed again, like SLRU, but the keys of
+  // evicted entries are remembered, and a key put again after being
+  // evicted from probation (or from the protected part) lets probation
+  // (or the protected part) take more of the cache
+  ARC,
+};
+
+// keeps the entries of an LruIndex in eviction order, the caches call it
+// wherever they add, access or erase an entry instead of moving the nodes
+// themselves. the value type of the index must have an unsigned char
+// |region| member, which the evictor owns, a default constructed value must
+// have it set to REGION_NONE, which marks the markers in the list.
+//
+// with TINY_LFU, two markers split the list in three, from the front: the
+// window, the candidates and the main part. entries are inserted to the
+// front of the window, which keeps 1% of the entries, the least recently
+// used entries of the window beyond that become candidates. a candidate
+// that is accessed again, or any entry of the main part, goes to the front
+// of the main part. when entries are to be evicted, the candidates compete
+// with the least recently used entries of the main part, oldest first, the
+// one with the lower estimated frequency is evicted, the candidate on a
+// tie, a candidate that wins joins the main part. frequencies are counted
+// in a FrequencySketch on hits and inserts, not on misses, which would
+// count a key twice when the miss is followed by putting it.
+// until the first eviction, entries leave the window to the main part
+// directly, there is nothing to compete with before the cache is full.
+//
+// with SLRU and ARC, a marker splits the list in the protected part in
+// front and probation behind it. ARC evicts from probation while it holds
+// more than its target number of entries, from the protected part
+// otherwise, and keeps the keys of as many evicted entries as the cache
+// held when evicting last, in a ghost list for each part.
+//
+// an entry changing regions stays where it is and the marker moves over it
+// instead, except for a TINY_LFU candidate that is accessed, which moves
+// back to the front of the main part, OnHit() tells when. DiskCache relies
+// on that for compacting its journal, it writes the entries from the back
+// of the list and must not miss an entry that moved behind its cursor.
+//
+// all calls must be made under the lock guarding the index
+template <typename Index, typename KeyHash>
+class Evictor {
+ public:
+   using Handle = typename Index::Handle;
+
+   static const unsigned char REGION_NONE = 0;
+   static const unsigned char REGION_WINDOW = 1;
+   static const unsigned char REGION_CANDIDATE = 2;
+   static const unsigned char REGION_MAIN = 3;
+   static const unsigned char REGION_PROBATION = 4;
+   static const unsigned char REGION_PROTECTED = 5;
+
+   Evictor(Index *index, EvictionPolicy policy,
+       const KeyHash &hash = KeyHash()) :
+     index_(index), policy_(policy), hash_(hash),
+     window_marker_(Index::INVALID_HANDLE),
+     main_marker_(Index::INVALID_HANDLE),
+     window_count_(0), evicted_(false),
+     probation_marker_(Index::INVALID_HANDLE),
+     probation_count_(0), protected_count_(0),
+     recent_ghosts_(hash), frequent_ghosts_(hash),
+     capacity_(0), target_(0) {
+     if (policy_ == EvictionPolicy::TINY_LFU) {
+       window_marker_ = index_->PushBackMarker(Value());
+       main_marker_ = index_->PushBackMarker(Value());
+     } else if (policy_ != EvictionPolicy::LRU) {
+       probation_marker_ = index_->PushBackMarker(Value());
+     }
+   }
+
+   Evictor(const Evictor &) = delete;
+   Evictor &operator=(const Evictor &) = delete;
+
+ public:
+   // |handle| has just been pushed to the front of the index
+   void OnInsert(Handle handle) {
+     if (policy_ == EvictionPolicy::LRU) {
+       RegionOf(handle) = REGION_MAIN;
+       return;
+     }
+
+     if (policy_ == EvictionPolicy::TINY_LFU) {
+       InsertToWindow(handle);
+       return;
+     }
+
+     // the key was evicted too early, it is protected right away
+     if (policy_ == EvictionPolicy::ARC &&
+         TakeGhost(index_->KeyOf(handle))) {
+       RegionOf(handle) = REGION_PROTECTED;
+       ++protected_count_;
+       return;
+     }
+
+     index_->MoveBefore(handle, index_->Next(probation_marker_));
+     RegionOf(handle) = REGION_PROBATION;
+     ++probation_count_;
+   }
+
+   // returns true if |handle| moved towards the back of the list
+   bool OnHit(Handle handle) {
+     bool moved_back = false;
+     if (policy_ == EvictionPolicy::TINY_LFU) {
+       if (RegionOf(handle) == REGION_WINDOW) {
+         index_->MoveToFront(handle);
+       } else {
+         moved_back = RegionOf(handle) == REGION_CANDIDATE;
+         MoveToMain(handle);
+       }
+       sketch_.Increment(HashOf(index_->KeyOf(handle)));
+
+     } else if (RegionOf(handle) == REGION_PROBATION) {
+       Protect(handle);
+
+     } else {
+       index_->MoveToFront(handle);
+     }
+     return moved_back;
+   }
+
+   // must be called before |handle| is erased from the index
+   void OnErase(Handle handle) {
+     unsigned char region = RegionOf(handle);
+     if (region == REGION_WINDOW) {
+       --window_count_;
+     } else if (region == REGION_PROBATION) {
+       --probation_count_;
+     } else if (region == REGION_PROTECTED) {
+       --protected_count_;
+     }
+   }
+
+   // evicts entries by calling |evict| with them until |over_limit|
+   // returns false, |evict| must erase the entry, calling OnErase() first
+   template <typename OverLimit, typename EvictFun>
+   void Evict(OverLimit &&over_limit, EvictFun &&evict) {
+     if (policy_ == EvictionPolicy::LRU) {
+       while (over_limit()) {
+         // only markers may be left
+         Handle last = LastEntry(index_->Back());
+         if (last == Index::INVALID_HANDLE) {
+           return;
+         }
+         evict(last);
+       }
+
+     } else if (policy_ == EvictionPolicy::TINY_LFU) {
+       EvictWithTinyLfu(over_limit, evict);
+
+     } else {
+       EvictSegmented(over_limit, evict);
+     }
+   }
+
+   bool IsMarker(Handle handle) const {
+     return index_->ValueOf(handle).region == REGION_NONE;
+   }
+
+   // replaying the journal inserts every entry where OnInsert() does, an
+   // entry in any other region needs its region journaled to get it back
+   bool ShouldJournalRegion(unsigned char region) const {
+     if (policy_ == EvictionPolicy::TINY_LFU) {
+       return region == REGION_CANDIDATE || region == REGION_MAIN;
+     }
+     return policy_ != EvictionPolicy::LRU && region == REGION_PROTECTED;
+   }
+
+   // puts an entry that has just been inserted back in the journaled
+   // |region|, which is ignored unless it belongs to the policy. the entry
+   // may move towards the back, which is fine while replaying the journal
+   void Restore(Handle handle, unsigned char region) {
+     if (policy_ == EvictionPolicy::TINY_LFU) {
+       if (RegionOf(handle) == REGION_WINDOW &&
+           (region == REGION_CANDIDATE || region == REGION_MAIN)) {
+         --window_count_;
+         MoveToMain(handle);
+       }
+
+     } else if (policy_ != EvictionPolicy::LRU &&
+         RegionOf(handle) == REGION_PROBATION &&
+         region == REGION_PROTECTED) {
+       Protect(handle);
+     }
+   }
+
+ private:
+   using Key = typename Index::KeyType;
+   using Value = typename Index::ValueType;
+   // the keys of evicted entries, the values are unused
+   using GhostIndex = LruIndex<Key, unsigned char, KeyHash>;
+   using GhostHandle = typename GhostIndex::Handle;
+
+   unsigned char &RegionOf(Handle handle) {
+     return index_->ValueOf(handle).region;
+   }
+
+   template <typename K>
+   uint64_t HashOf(const K &key) const {
+     return static_cast<uint64_t>(hash_(key));
+   }
+
+   // |handle| or the first entry in front of it that is not a marker
+   Handle LastEntry(Handle handle) const {
+     while (handle != Index::INVALID_HANDLE && IsMarker(handle)) {
+       handle = index_->Prev(handle);
+     }
+     return handle;
+   }
+
+   // the last entry in front of |end|, or of the back if |end| is
+   // INVALID_HANDLE, if it is in |region|
+   Handle LastEntryOf(Handle end, unsigned char region) const {
+     Handle handle = LastEntry(end == Index::INVALID_HANDLE ?
+         index_->Back() : index_->Prev(end));
+     return handle != Index::INVALID_HANDLE &&
+       index_->ValueOf(handle).region == region ?
+       handle : Index::INVALID_HANDLE;
+   }
+
+   void InsertToWindow(Handle handle) {
+     RegionOf(handle) = REGION_WINDOW;
+     ++window_count_;
+     sketch_.EnsureCapacity(index_->Size());
+     sketch_.Increment(HashOf(index_->KeyOf(handle)));
+
+     long window_share = index_->Size() / 100;
+     while (window_count_ > (window_share > 0 ? window_share : 1)) {
+       Handle last = LastEntry(index_->Prev(window_marker_));
+       --window_count_;
+       if (evicted_) {
+         // moving the marker makes it the front candidate
+         index_->MoveBefore(window_marker_, last);
+         RegionOf(last) = REGION_CANDIDATE;
+       } else {
+         // there are no candidates yet, moving both markers makes it the
+         // front of the main part
+         index_->MoveBefore(main_marker_, last);
+         index_->MoveBefore(window_marker_, main_marker_);
+         RegionOf(last) = REGION_MAIN;
+       }
+     }
+   }
+
+   void MoveToMain(Handle handle) {
+     index_->MoveBefore(handle, index_->Next(main_marker_));
+     RegionOf(handle) = REGION_MAIN;
+   }
+
+   template <typename OverLimit, typename EvictFun>
+   void EvictWithTinyLfu(OverLimit &over_limit, EvictFun &evict) {
+     evicted_ = true;
+     while (over_limit()) {
+       Handle candidate = LastEntryOf(main_marker_, REGION_CANDIDATE);
+       Handle victim = LastEntryOf(Index::INVALID_HANDLE, REGION_MAIN);
+
+       if (candidate == Index::INVALID_HANDLE ||
+           victim == Index::INVALID_HANDLE) {
+         // nothing to compete, the window is the last to go
+         Handle last = victim != Index::INVALID_HANDLE ? victim :
+           candidate != Index::INVALID_HANDLE ? candidate :
+           LastEntry(index_->Back());
+         if (last == Index::INVALID_HANDLE) {
+           return;
+         }
+         evict(last);
+         continue;
+       }
+
+       if (sketch_.Frequency(HashOf(index_->KeyOf(candidate))) >
+           sketch_.Frequency(HashOf(index_->KeyOf(victim)))) {
+         evict(victim);
+         // moving the marker of the main part in front of the candidate
+         // makes it the front of the main part
+         index_->MoveBefore(main_marker_, candidate);
+         RegionOf(candidate) = REGION_MAIN;
+       } else {
+         evict(candidate);
+       }
+     }
+   }
+
+   // SLRU and ARC
+   template <typename OverLimit, typename EvictFun>
+   void EvictSegmented(OverLimit &over_limit, EvictFun &evict) {
+     bool arc = policy_ == EvictionPolicy::ARC;
+     if (arc) {
+       capacity_ = index_->Size();
+     }
+
+     while (over_limit()) {
+       Handle recent = LastEntryOf(Index::INVALID_HANDLE, REGION_PROBATION);
+       Handle frequent = LastEntryOf(probation_marker_, REGION_PROTECTED);
+       Handle victim = recent != Index::INVALID_HANDLE &&
+         (!arc || frequent == Index::INVALID_HANDLE ||
+          probation_count_ > target_) ? recent : frequent;
+       if (victim == Index::INVALID_HANDLE) {
+         return;
+       }
+
+       if (!arc) {
+         evict(victim);
+         continue;
+       }
+
+       // the key is copied before |evict| erases the entry
+       Key key(index_->KeyOf(victim));
+       GhostIndex &ghosts =
+         victim == recent ? recent_ghosts_ : frequent_ghosts_;
+       evict(victim);
+       if (ghosts.Find(key) == GhostIndex::INVALID_HANDLE) {
+         ghosts.PushFront(std::move(key), 0);
+       }
+       TrimGhosts();
+     }
+   }
+
+   void Protect(Handle handle) {
+     --probation_count_;
+     ++protected_count_;
+     RegionOf(handle) = REGION_PROTECTED;
+     index_->MoveToFront(handle);
+
+     if (policy_ != EvictionPolicy::SLRU) {
+       return;
+     }
+
+     // moving the marker makes the least recently used protected entries
+     // beyond the share the front of probation
+     long protected_share = index_->Size() * 4 / 5;
+     while (protected_count_ > (protected_share > 0 ? protected_share : 1)) {
+       Handle last = LastEntryOf(probation_marker_, REGION_PROTECTED);
+       index_->MoveBefore(probation_marker_, last);
+       RegionOf(last) = REGION_PROBATION;
+       --protected_count_;
+       ++probation_count_;
+     }
+   }
+
+   // returns true if |key| was in a ghost list, and moves the target of
+   // probation towards the list it was in, by more the shorter the list
+   bool TakeGhost(const Key &key) {
+     long recent_count = recent_ghosts_.Size();
+     long frequent_count = frequent_ghosts_.Size();
+
+     GhostHandle ghost = recent_ghosts_.Find(key);
+     if (ghost != GhostIndex::INVALID_HANDLE) {
+       target_ += recent_count < frequent_count ?
+         frequent_count / recent_count : 1;
+       if (target_ > capacity_) {
+         target_ = capacity_;
+       }
+       recent_ghosts_.Erase(ghost);
+       return true;
+     }
+
+     ghost = frequent_ghosts_.Find(key);
+     if (ghost != GhostIndex::INVALID_HANDLE) {
+       target_ -= frequent_count < recent_count ?
+         recent_count / frequent_count : 1;
+       if (target_ < 0) {
+         target_ = 0;
+       }
+       frequent_ghosts_.Erase(ghost);
+       return true;
+     }
+
+     return false;
+   }
+
+   // probation and its ghosts together, and all entries and ghosts, are
+   // kept within 1 and 2 times |capacity_|
+   void TrimGhosts() {
+     while (!recent_ghosts_.Empty() &&
+         probation_count_ + static_cast<long>(recent_ghosts_.Size()) >
+         capacity_) {
+       recent_ghosts_.Erase(recent_ghosts_.Back());
+     }
+
+     while (!frequent_ghosts_.Empty() &&
+         static_cast<long>(index_->Size() + recent_ghosts_.Size() +
+           frequent_ghosts_.Size()) > capacity_ * 2) {
+       frequent_ghosts_.Erase(frequent_ghosts_.Back());
+     }
+   }
+
+ private:
+   Index *index_;
+   EvictionPolicy policy_;
+   KeyHash hash_;
+
+   // TINY_LFU only
+   FrequencySketch sketch_;
+   // the window is in front of |window_marker_|, the main part behind
+   // |main_marker_|, the candidates in between
+   Handle window_marker_;
+   Handle main_marker_;
+   long window_count_;
+   bool evicted_;
+
+   // SLRU and ARC, probation is behind |probation_marker_|
+   Handle probation_marker_;
+   long probation_count_;
+   long protected_count_;
+
+   // ARC only, the most recently evicted keys first. |capacity_| is the
+   // number of entries when evicting last, |target_| the number of entries
+   // probation is meant to keep
+   GhostIndex recent_ghosts_;
+   GhostIndex frequent_ghosts_;
+   long capacity_;
+   long target_;
+};
+
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_NONE;
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_WINDOW;
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_CANDIDATE;
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_MAIN;
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_PROBATION;
+template <typename Index, typename KeyHash>
+const unsigned char Evictor<Index, KeyHash>::REGION_PROTECTED;
+
+};  // namespace lru
+
+#endif /* end of include guard: EVICTOR_H_ */
@@ -0,0 +1,111 @@
+/*******************************************************************************
+**          File: file_reaper.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:16 AM
+**   Description: deletes the files of DiskCache on worker threads, after
+**                moving them into a trash directory
+*******************************************************************************/
+#include "file_reaper.h"
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include "common/file_util.h"
+#include "log/log.h"
+
+namespace lru {
+
+FileReaper::FileReaper(const std::string &dir, int thread_count) :
+  dir_(dir),
+  seq_(0) {
+  prefix_ = std::to_string(std::chrono::system_clock::now()
+      .time_since_epoch().count()).append(1, '.');
+
+  for (int i = 0; i < thread_count; ++i) {
+    workers_.emplace_back(&FileReaper::RunWorker, this);
+  }
+}
+
+FileReaper::~FileReaper() {
+  trash_files_.QuitBlocking();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+bool FileReaper::Open() {
+  if (workers_.empty()) {
+    // nothing gets moved to the trash, but an earlier run may have
+    if (!FileUtil::DirExists(dir_)) {
+      return true;
+    }
+  } else if (!FileUtil::DirExists(dir_) && !FileUtil::MakeDirs(dir_)) {
+    LOG_E("lru::FileReaper", "failed to create dir %s", dir_.c_str());
+    return false;
+  }
+
+  DIR *dir = ::opendir(dir_.c_str());
+  if (!dir) {
+    LOG_E("lru::FileReaper", "failed to open dir %s: %s", dir_.c_str(),
+        strerror(errno));
+    return false;
+  }
+
+  std::vector<std::string> leftovers;
+  struct dirent *ent;
+  while ((ent = ::readdir(dir)) != nullptr) {
+    if (std::strcmp(ent->d_name, ".") != 0 &&
+        std::strcmp(ent->d_name, "..") != 0) {
+      leftovers.push_back(dir_ + '/' + ent->d_name);
+    }
+  }
+  ::closedir(dir);
+
+  LOG_V("lru::FileReaper", "%zd files left in %s", leftovers.size(),
+      dir_.c_str());
+
+  for (auto &file : leftovers) {
+    if (workers_.empty()) {
+      FileUtil::DeleteFile(file);
+    } else {
+      trash_files_.PushBack(file);
+    }
+  }
+  return true;
+}
+
+void FileReaper::Dispose(const std::string &file) {
+  if (workers_.empty()) {
+    FileUtil::DeleteFile(file);
+    return;
+  }
+
+  std::string trash_file(dir_);
+  trash_file.append(1, '/').append(prefix_).append(
+      std::to_string(++seq_));
+  if (std::rename(file.c_str(), trash_file.c_str()) != 0) {
+    if (errno != ENOENT) {
+      LOG_W("lru::FileReaper", "failed to move %s to the trash: %s",
+          file.c_str(), strerror(errno));
+      FileUtil::DeleteFile(file);
+    }
+    return;
+  }
+
+  trash_files_.PushBack(std::move(trash_file));
+}
+
+// keeps deleting until the queue has quit and is empty
+void FileReaper::RunWorker() {
+  std::string file;
+  while (trash_files_.TakeFront(&file)) {
+    if (::unlink(file.c_str()) != 0 && errno != ENOENT) {
+      LOG_E("lru::FileReaper", "failed to delete %s: %s", file.c_str(),
+          strerror(errno));
+    }
+  }
+}
+
+};  // namespace lru
@@ -0,0 +1,54 @@
+/*******************************************************************************
+**          File: file_reaper.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:16 AM
+**   Description: deletes the files of DiskCache on worker threads, after
+**                moving them into a trash directory
+*******************************************************************************/
+#ifndef FILE_REAPER_H_
+#define FILE_REAPER_H_
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "common/blocking_queue.h"
+
+namespace lru {
+
+// deleting a file frees its blocks, which takes a while for a large file on
+// a slow disk. Dispose() only renames the file into |dir|, which must be on
+// the same file system, and the worker threads delete it from there, so the
+// caller is done with the file after a metadata update.
+//
+// files left in |dir| by an earlier run are deleted after Open(), the
+// files disposed of but not deleted yet are deleted before the destructor
+// returns. with no worker threads, Dispose() deletes the file right away.
+class FileReaper {
+ public:
+   FileReaper(const std::string &dir, int thread_count);
+   ~FileReaper();
+
+   FileReaper(const FileReaper &) = delete;
+   FileReaper &operator=(const FileReaper &) = delete;
+
+ public:
+   bool Open();
+   // |file| is gone from where it was once this returns, if it existed
+   void Dispose(const std::string &file);
+
+ private:
+   void RunWorker();
+
+ private:
+   std::string dir_;
+   // trash files are named <prefix_><seq_>, the prefix tells runs apart
+   std::string prefix_;
+   std::atomic<unsigned long> seq_;
+
+   BlockingQueue<std::string> trash_files_;
+   std::vector<std::thread> workers_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: FILE_REAPER_H_ */
@@ -0,0 +1,110 @@
+/*******************************************************************************
+**          File: frequency_sketch.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 12:46 AM
+**   Description: a count-min sketch estimating how often keys were accessed
+**                recently, the frequency filter of W-TinyLFU
+*******************************************************************************/
+#include "frequency_sketch.h"
+
+namespace lru {
+
+namespace {
+  const int ROW_COUNT = 4;
+  const int MAX_COUNT = 15;
+  const std::size_t MIN_WIDTH = 16;
+  // 32MB of counters
+  const std::size_t MAX_WIDTH = 1 << 22;
+  const int SAMPLE_FACTOR = 10;
+
+  const uint64_t ROW_SEEDS[ROW_COUNT] = {
+    0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+    0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL
+  };
+};
+
+FrequencySketch::FrequencySketch() : additions_(0), sample_size_(0) {
+}
+
+void FrequencySketch::EnsureCapacity(long capacity) {
+  if (capacity <= static_cast<long>(table_.size())) {
+    return;
+  }
+
+  std::size_t width = MIN_WIDTH;
+  while (static_cast<long>(width) < capacity && width < MAX_WIDTH) {
+    width <<= 1;
+  }
+  if (width <= table_.size()) {
+    return;
+  }
+
+  table_.assign(width, 0);
+  additions_ = 0;
+  sample_size_ = SAMPLE_FACTOR * static_cast<long>(width);
+}
+
+void FrequencySketch::Increment(uint64_t hash) {
+  if (table_.empty()) {
+    EnsureCapacity(MIN_WIDTH);
+  }
+
+  bool added = false;
+  for (int row = 0; row < ROW_COUNT; ++row) {
+    std::size_t index;
+    int shift;
+    Locate(hash, row, &index, &shift);
+    if (((table_[index] >> shift) & 0xf) < MAX_COUNT) {
+      table_[index] += 1ULL << shift;
+      added = true;
+    }
+  }
+
+  if (added && ++additions_ >= sample_size_) {
+    Halve();
+  }
+}
+
+int FrequencySketch::Frequency(uint64_t hash) const {
+  if (table_.empty()) {
+    return 0;
+  }
+
+  int frequency = MAX_COUNT;
+  for (int row = 0; row < ROW_COUNT; ++row) {
+    std::size_t index;
+    int shift;
+    Locate(hash, row, &index, &shift);
+    int count = static_cast<int>((table_[index] >> shift) & 0xf);
+    if (count < frequency) {
+      frequency = count;
+    }
+  }
+  return frequency;
+}
+
+// shifting a word right by one halves all of its counters at once, the bit
+// each counter takes over from its neighbour is masked off
+void FrequencySketch::Halve() {
+  for (auto &word : table_) {
+    word = (word >> 1) & 0x7777777777777777ULL;
+  }
+  additions_ /= 2;
+}
+
+// the row seed is mixed into the hash with the finalizer of MurmurHash3,
+// the low 4 bits pick the counter within the word, the rest the word
+void FrequencySketch::Locate(uint64_t hash, int row, std::size_t *index,
+    int *shift) const {
+  uint64_t h = hash ^ ROW_SEEDS[row];
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  *index = static_cast<std::size_t>(h >> 4) & (table_.size() - 1);
+  *shift = static_cast<int>(h & 0xf) << 2;
+}
+
+};  // namespace lru
@@ -0,0 +1,48 @@
+/*******************************************************************************
+**          File: frequency_sketch.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 12:46 AM
+**   Description: a count-min sketch estimating how often keys were accessed
+**                recently, the frequency filter of W-TinyLFU
+*******************************************************************************/
+#ifndef FREQUENCY_SKETCH_H_
+#define FREQUENCY_SKETCH_H_
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace lru {
+
+// the counters are 4 bits wide, 16 to a word, and a key is counted in 4 of
+// them picked from different words by its hash, its frequency being the
+// smallest of the 4. once the number of increments reaches 10 times the
+// number of words, every counter is halved, so the estimate reflects the
+// recent accesses rather than all of them.
+//
+// the sketch starts out with no table, EnsureCapacity() sizes it for the
+// number of keys the cache holds
+class FrequencySketch {
+ public:
+   FrequencySketch();
+
+ public:
+   // grows the table to a word per key for |capacity| keys, up to a
+   // maximum. growing discards the counts
+   void EnsureCapacity(long capacity);
+   // |hash| must be a well mixed 64-bit hash of the key
+   void Increment(uint64_t hash);
+   int Frequency(uint64_t hash) const;
+
+ private:
+   void Halve();
+   void Locate(uint64_t hash, int row, std::size_t *index, int *shift) const;
+
+ private:
+   std::vector<uint64_t> table_;
+   long additions_;
+   long sample_size_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: FREQUENCY_SKETCH_H_ */
@@ -0,0 +1,539 @@
+/*******************************************************************************
+**          File: journal.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-16 Fri 11:58 PM
+**   Description: the journal of DiskCache, a text header followed by
+**                fixed-size binary records
+*******************************************************************************/
+#include "journal.h"
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include "common/file_util.h"
+#include "common/mapped_file.h"
+#include "common/crc32/crc32.h"
+#include "log/log.h"
+
+namespace lru {
+
+namespace {
+  const std::string MAGIC_STRING("neevek_disklru");
+  const std::string VERSION("2.1.0");
+  const std::string NO_HASHER_VERSION("2.0.0");
+  const std::string TEXT_VERSION("1.0.0");
+  // the key hasher of journals whose header does not name one
+  const std::string DEFAULT_KEY_HASHER("sha1");
+  const char LINE_FEED = '\n';
+
+  const int SHA1_SIZE = 20;
+  const char FLAG_PACKED = 0x01;
+
+  void EncodeFixed32(char *buf, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+      buf[i] = static_cast<char>(value >> (i * 8));
+    }
+  }
+
+  void EncodeFixed64(char *buf, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+      buf[i] = static_cast<char>(value >> (i * 8));
+    }
+  }
+
+  uint32_t DecodeFixed32(const char *buf) {
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(buf);
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  uint64_t DecodeFixed64(const char *buf) {
+    return DecodeFixed32(buf) | ((uint64_t)DecodeFixed32(buf + 4) << 32);
+  }
+
+  void EncodeRecord(char action, const std::string &sha1_key, long size,
+      int segment, long offset, char *buf) {
+    std::memset(buf, 0, Journal::RECORD_SIZE);
+    buf[0] = action;
+    std::memcpy(buf + 8, sha1_key.data(), SHA1_SIZE);
+    EncodeFixed64(buf + 32, size);
+    if (segment >= 0) {
+      buf[1] |= FLAG_PACKED;
+      EncodeFixed32(buf + 28, segment);
+      EncodeFixed64(buf + 40, offset);
+    }
+    EncodeFixed32(buf + 4, crc32::calc(buf, Journal::RECORD_SIZE));
+  }
+
+  bool DecodeRecord(const char *buf, char *action, std::string *sha1_key,
+      long *size, int *segment, long *offset) {
+    static const char zeros[4] = { 0 };
+
+    uint32_t crc = crc32::calc(buf, 4);
+    crc = crc32::calc(zeros, 4, crc);
+    crc = crc32::calc(buf + 8, Journal::RECORD_SIZE - 8, crc);
+    if (crc != DecodeFixed32(buf + 4)) {
+      return false;
+    }
+
+    *action = buf[0];
+    sha1_key->assign(buf + 8, SHA1_SIZE);
+    *size = static_cast<long>(DecodeFixed64(buf + 32));
+    if (buf[1] & FLAG_PACKED) {
+      *segment = static_cast<int>(DecodeFixed32(buf + 28));
+      *offset = static_cast<long>(DecodeFixed64(buf + 40));
+    } else {
+      *segment = -1;
+      *offset = 0;
+    }
+    return true;
+  }
+
+  bool HexToSha1Key(const char *hex, std::size_t len, std::string *sha1_key) {
+    if (len != SHA1_SIZE * 2) {
+      return false;
+    }
+
+    sha1_key->resize(SHA1_SIZE);
+    for (int i = 0; i < SHA1_SIZE * 2; ++i) {
+      char c = hex[i];
+      int v;
+      if (c >= '0' && c <= '9') {
+        v = c - '0';
+      } else if (c >= 'a' && c <= 'f') {
+        v = c - 'a' + 10;
+      } else {
+        return false;
+      }
+
+      if (i % 2 == 0) {
+        (*sha1_key)[i / 2] = static_cast<char>(v << 4);
+      } else {
+        (*sha1_key)[i / 2] |= static_cast<char>(v);
+      }
+    }
+
+    return true;
+  }
+
+  // points |line| to the next line in [*p, end) without its line feed
+  bool NextLine(const char **p, const char *end, const char **line,
+      std::size_t *len) {
+    if (*p >= end) {
+      return false;
+    }
+
+    const char *lf = static_cast<const char *>(
+        std::memchr(*p, LINE_FEED, end - *p));
+    *line = *p;
+    *len = (lf ? lf : end) - *p;
+    *p = lf ? lf + 1 : end;
+    return true;
+  }
+
+  bool ParseLong(const char *p, const char *end, long *value) {
+    if (p == end) {
+      return false;
+    }
+
+    *value = 0;
+    for (; p < end; ++p) {
+      if (*p < '0' || *p > '9') {
+        return false;
+      }
+      *value = *value * 10 + (*p - '0');
+    }
+    return true;
+  }
+};
+
+const char Journal::ACTION_READ;
+const char Journal::ACTION_UPDATE;
+const char Journal::ACTION_DELETE;
+const char Journal::ACTION_MOVE;
+const char Journal::ACTION_REGION;
+const int Journal::RECORD_SIZE;
+
+Journal::Journal(const std::string &file, long app_version,
+    const std::string &key_hasher, const FlushPolicy &policy) :
+  file_(file),
+  app_version_(app_version),
+  key_hasher_(key_hasher),
+  policy_(policy),
+  journal_fd_(-1),
+  buffered_count_(0),
+  unsynced_(false),
+  last_sync_time_(Clock::now()),
+  record_count_(0),
+  flush_count_(0),
+  sync_count_(0),
+  rewrite_count_(0),
+  rewriting_(false) {
+}
+
+Journal::~Journal() {
+  Close();
+}
+
+bool Journal::Replay(const RecordHandler &handler, bool *needs_rewrite) {
+  std::string bak_jn_file(file_ + ".bak");
+  if (FileUtil::FileExists(bak_jn_file)) {
+    std::rename(bak_jn_file.c_str(), file_.c_str());
+  }
+
+  if (!FileUtil::FileExists(file_)) {
+    return false;
+  }
+
+  MappedFile jn_file;
+  jn_file.Open(file_);
+  jn_file.AdviseSequential();
+
+  const char *p = jn_file.Data();
+  const char *end = p + jn_file.Size();
+
+  std::string version;
+  if (!jn_file.IsOpen() || !ReadHeader(&p, end, &version)) {
+    LOG_E("lru::Journal", "initializing from journal failed: %s",
+        file_.c_str());
+
+    jn_file.Close();
+    FileUtil::DeleteFile(file_);
+    return false;
+  }
+
+  LOG_V("lru::Journal", "journal file exists, ready to read it");
+
+  if (version == TEXT_VERSION) {
+    LOG_I("lru::Journal", "migrating text journal: %s", file_.c_str());
+    ReplayTextRecords(p, end, handler);
+    *needs_rewrite = true;
+
+  } else {
+    std::size_t valid_size =
+      (p - jn_file.Data()) + ReplayBinaryRecords(p, end, handler);
+    *needs_rewrite = version != VERSION;
+
+    if (valid_size != jn_file.Size()) {
+      LOG_W("lru::Journal", "torn journal tail, truncating %s at %zd",
+          file_.c_str(), valid_size);
+
+      jn_file.Close();
+      if (::truncate(file_.c_str(), valid_size) != 0) {
+        LOG_E("lru::Journal", "failed to truncate %s", file_.c_str());
+      }
+    }
+  }
+
+  return true;
+}
+
+bool Journal::ReadHeader(const char **p, const char *end,
+    std::string *version) {
+  const char *line;
+  std::size_t len;
+  std::string app_version(std::to_string(app_version_));
+
+  if (!NextLine(p, end, &line, &len) ||
+      MAGIC_STRING.compare(0, std::string::npos, line, len) != 0 ||
+      !NextLine(p, end, &line, &len)) {
+    return false;
+  }
+
+  version->assign(line, len);
+  if ((*version != VERSION && *version != NO_HASHER_VERSION &&
+        *version != TEXT_VERSION) ||
+      !NextLine(p, end, &line, &len) ||
+      app_version.compare(0, std::string::npos, line, len) != 0) {
+    return false;
+  }
+
+  std::string key_hasher(DEFAULT_KEY_HASHER);
+  if (*version == VERSION) {
+    if (!NextLine(p, end, &line, &len)) {
+      return false;
+    }
+    key_hasher.assign(line, len);
+  }
+
+  if (key_hasher != key_hasher_) {
+    LOG_W("lru::Journal", "%s was written with key hasher %s instead of %s",
+        file_.c_str(), key_hasher.c_str(), key_hasher_.c_str());
+    return false;
+  }
+
+  return NextLine(p, end, &line, &len) && len == 0;
+}
+
+void Journal::ReplayTextRecords(const char *p, const char *end,
+    const RecordHandler &handler) {
+
+  const char *line;
+  std::size_t len;
+  std::string sha1_key;
+  while (NextLine(&p, end, &line, &len)) {
+    if (len == 0) {
+      continue;
+    }
+
+    const char *line_end = line + len;
+    const char *first_space = static_cast<const char *>(
+        std::memchr(line, ' ', len));
+    if (!first_space) {
+      LOG_E("lru::Journal", "invalid line: %.*s", (int)len, line);
+      continue;
+    }
+
+    const char *key = first_space + 1;
+    const char *second_space = static_cast<const char *>(
+        std::memchr(key, ' ', line_end - key));
+    const char *key_end = second_space ? second_space : line_end;
+
+    long file_size = 0;
+    if (line[0] == ACTION_UPDATE &&
+        (!second_space ||
+         !ParseLong(second_space + 1, line_end, &file_size))) {
+      LOG_E("lru::Journal", "invalid line: %.*s", (int)len, line);
+      continue;
+    }
+
+    if (!HexToSha1Key(key, key_end - key, &sha1_key)) {
+      LOG_E("lru::Journal", "invalid line: %.*s", (int)len, line);
+      continue;
+    }
+
+    handler(line[0], sha1_key, file_size, -1, 0);
+  }
+}
+
+std::size_t Journal::ReplayBinaryRecords(const char *p, const char *end,
+    const RecordHandler &handler) {
+
+  const char *start = p;
+  std::string sha1_key;
+  char action;
+  long file_size;
+  int segment;
+  long offset;
+
+  // a record cut short or failing its CRC ends the journal
+  for (; end - p >= RECORD_SIZE; p += RECORD_SIZE) {
+    if (!DecodeRecord(p, &action, &sha1_key, &file_size, &segment,
+          &offset)) {
+      break;
+    }
+
+    handler(action, sha1_key, file_size, segment, offset);
+  }
+
+  return p - start;
+}
+
+void Journal::WriteHeader(std::ofstream &ofs) {
+  ofs << MAGIC_STRING << LINE_FEED;
+  ofs << VERSION << LINE_FEED;
+  ofs << app_version_ << LINE_FEED;
+  ofs << key_hasher_ << LINE_FEED;
+  ofs << LINE_FEED;
+}
+
+bool Journal::Open() {
+  journal_fd_ = ::open(file_.c_str(),
+      O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (journal_fd_ < 0) {
+    LOG_E("lru::Journal", "failed to open %s: %s", file_.c_str(),
+        strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+void Journal::Close() {
+  if (journal_fd_ >= 0) {
+    Flush();
+    if (unsynced_) {
+      Sync();
+    }
+
+    ::close(journal_fd_);
+    journal_fd_ = -1;
+    LOG_D("lru::Journal", "close original journal file");
+  }
+}
+
+void Journal::Append(char action, const std::string &sha1_key, long size,
+    int segment, long offset) {
+  char buf[RECORD_SIZE];
+  EncodeRecord(action, sha1_key, size, segment, offset, buf);
+
+  if (buffered_count_ == 0) {
+    first_buffered_time_ = Clock::now();
+  }
+  buffer_.append(buf, RECORD_SIZE);
+  ++buffered_count_;
+
+  if (rewriting_) {
+    rewrite_tail_.append(buf, RECORD_SIZE);
+  }
+
+  if (buffer_.size() >= policy_.max_buffered_bytes ||
+      MillisToNextFlush() == 0) {
+    Flush();
+  }
+}
+
+void Journal::Flush() {
+  if (buffered_count_ == 0 || journal_fd_ < 0) {
+    return;
+  }
+
+  const char *p = buffer_.data();
+  std::size_t remaining = buffer_.size();
+  while (remaining > 0) {
+    ssize_t written = ::write(journal_fd_, p, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      // the records are lost, replaying stops at a torn one if any
+      LOG_E("lru::Journal", "failed to write %s: %s", file_.c_str(),
+          strerror(errno));
+      break;
+    }
+    p += written;
+    remaining -= written;
+  }
+
+  record_count_ += buffered_count_;
+  ++flush_count_;
+  buffer_.clear();
+  buffered_count_ = 0;
+  unsynced_ = true;
+
+  if (policy_.sync == SYNC_PER_FLUSH ||
+      (policy_.sync == SYNC_PERIODIC && MillisToNextSync() == 0)) {
+    Sync();
+  }
+}
+
+void Journal::Sync() {
+  if (journal_fd_ < 0 || policy_.sync == SYNC_NONE) {
+    unsynced_ = false;
+    return;
+  }
+
+#ifdef __linux__
+  ::fdatasync(journal_fd_);
+#else
+  ::fsync(journal_fd_);
+#endif
+  ++sync_count_;
+  unsynced_ = false;
+  last_sync_time_ = Clock::now();
+}
+
+int Journal::MillisUntilDue() const {
+  int flush_ms = MillisToNextFlush();
+  int sync_ms = MillisToNextSync();
+  if (flush_ms < 0 || (sync_ms >= 0 && sync_ms < flush_ms)) {
+    return sync_ms;
+  }
+  return flush_ms;
+}
+
+void Journal::FlushIfDue() {
+  if (MillisToNextFlush() == 0) {
+    Flush();
+  }
+  if (MillisToNextSync() == 0) {
+    Sync();
+  }
+}
+
+int Journal::MillisToNextFlush() const {
+  if (buffered_count_ == 0) {
+    return -1;
+  }
+
+  long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - first_buffered_time_).count();
+  return elapsed >= policy_.max_delay_ms ? 0 : policy_.max_delay_ms - elapsed;
+}
+
+int Journal::MillisToNextSync() const {
+  if (!unsynced_ || policy_.sync != SYNC_PERIODIC) {
+    return -1;
+  }
+
+  long elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now() - last_sync_time_).count();
+  return elapsed >= policy_.sync_interval_ms ?
+    0 : policy_.sync_interval_ms - elapsed;
+}
+
+Journal::Stats Journal::GetStats() const {
+  Stats stats;
+  stats.record_count = record_count_;
+  stats.flush_count = flush_count_;
+  stats.sync_count = sync_count_;
+  stats.rewrite_count = rewrite_count_;
+  return stats;
+}
+
+bool Journal::BeginRewrite() {
+  rewrite_ofstream_.open(file_ + ".tmp", std::ios::binary | std::ios::trunc);
+  if (!rewrite_ofstream_.is_open()) {
+    LOG_E("lru::Journal", "failed to create tmp journal for %s",
+        file_.c_str());
+    return false;
+  }
+
+  WriteHeader(rewrite_ofstream_);
+  rewriting_ = true;
+  rewrite_tail_.clear();
+  return true;
+}
+
+void Journal::Rewrite(char action, const std::string &sha1_key, long size,
+    int segment, long offset) {
+  char buf[RECORD_SIZE];
+  EncodeRecord(action, sha1_key, size, segment, offset, buf);
+  rewrite_ofstream_.write(buf, RECORD_SIZE);
+}
+
+bool Journal::CommitRewrite() {
+  std::string tmp_jn_file(file_ + ".tmp");
+  std::string bak_jn_file(file_ + ".bak");
+
+  rewrite_ofstream_.write(rewrite_tail_.data(), rewrite_tail_.size());
+  rewrite_ofstream_.close();
+  rewriting_ = false;
+  rewrite_tail_.clear();
+  rewrite_tail_.shrink_to_fit();
+  Close();
+
+  // rename original to bak
+  if (FileUtil::FileExists(file_)) {
+    FileUtil::DeleteFile(bak_jn_file);
+    std::rename(file_.c_str(), bak_jn_file.c_str());
+
+    LOG_D("lru::Journal", "backup original journal file");
+  }
+
+  // rename tmp to original
+  bool renamed = std::rename(tmp_jn_file.c_str(), file_.c_str()) == 0;
+  if (renamed) {
+    FileUtil::DeleteFile(bak_jn_file);
+
+    LOG_D("lru::Journal", "rename tmp journal file to original journal file");
+    LOG_D("lru::Journal", "%s -> %s", tmp_jn_file.c_str(), file_.c_str());
+  }
+
+  Open();
+  ++rewrite_count_;
+
+  LOG_V("lru::Journal", "journal opened");
+  return renamed;
+}
+
+};  // namespace lru
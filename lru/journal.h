@@ -0,0 +1,177 @@
+/*******************************************************************************
+**          File: journal.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-16 Fri 11:58 PM
+**   Description: the journal of DiskCache, a text header followed by
+**                fixed-size binary records
+*******************************************************************************/
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+#include <string>
+#include <fstream>
+#include <functional>
+#include <atomic>
+#include <chrono>
+
+namespace lru {
+
+// Journal layout:
+//
+//   neevek_disklru\n
+//   2.1.0\n
+//   <app_version>\n
+//   <key_hasher>\n
+//   \n
+//   record...
+//
+// every record is RECORD_SIZE bytes, multi-byte fields are little-endian:
+//
+//   offset  size  field
+//        0     1  action, one of 'U', 'R', 'D', 'M', 'P'
+//        1     1  flags, bit 0 is set for a packed entry
+//        2     2  reserved, 0
+//        4     4  CRC-32C of the record, computed with this field zeroed
+//        8    20  digest of the key, zero-padded if shorter
+//       28     4  segment of a packed entry, 0 otherwise
+//       32     8  size of the cache data, the region of a 'P' record
+//       40     8  offset in the segment of a packed entry, 0 otherwise
+//
+// a packed entry is stored in a segment file shared with other entries
+// instead of a file of its own, see SegmentStore. 'M' records move a packed
+// entry to another segment without touching its recency. 'P' records put
+// an entry in a region of the eviction policy, see Evictor, they follow
+// the 'U' record of the entry when the journal is rewritten.
+//
+// a record whose CRC does not match or that is cut short marks the end of
+// the journal, the file is truncated there on replay. a journal written
+// with another key hasher is unusable. journals in the 2.0.0 format, which
+// lacks the key hasher line, and in the 1.0.0 text format were written with
+// "sha1" and are still replayed, the caller is expected to rewrite them in
+// the current format.
+//
+// appended records are buffered and written in batches, how often they are
+// written and synced to disk is set by FlushPolicy. all methods except
+// GetStats() are expected to be called from the same thread.
+class Journal {
+ public:
+   static const char ACTION_READ = 'R'; // READ
+   static const char ACTION_UPDATE = 'U'; // UPDATE
+   static const char ACTION_DELETE = 'D'; // DELETE
+   static const char ACTION_MOVE = 'M'; // MOVE
+   static const char ACTION_REGION = 'P'; // POLICY REGION
+   static const int RECORD_SIZE = 48;
+
+   // |sha1_key| holds the 20 bytes of the digest, |segment| is -1 unless
+   // the record is for a packed entry
+   using RecordHandler = std::function<void(char action,
+       const std::string &sha1_key, long size, int segment, long offset)>;
+
+   enum SyncPolicy {
+     SYNC_NONE,      // leave it to the OS
+     SYNC_PERIODIC,  // fdatasync at most every |sync_interval_ms|
+     SYNC_PER_FLUSH  // fdatasync after every batch written
+   };
+
+   struct FlushPolicy {
+     // buffered records are written once they take this many bytes, 0
+     // writes every record right away
+     std::size_t max_buffered_bytes;
+     // or once the oldest buffered record is this old, the owner is
+     // expected to call FlushIfDue() in time when no records are appended
+     int max_delay_ms;
+     SyncPolicy sync;
+     int sync_interval_ms;
+
+     FlushPolicy() : max_buffered_bytes(64 * 1024), max_delay_ms(10),
+       sync(SYNC_NONE), sync_interval_ms(1000) { }
+   };
+
+   struct Stats {
+     long record_count;  // records written
+     long flush_count;   // write(2) batches the records went out in
+     long sync_count;    // fdatasync calls
+     long rewrite_count; // committed rewrites
+
+     Stats() : record_count(0), flush_count(0), sync_count(0),
+       rewrite_count(0) { }
+   };
+
+   // |key_hasher| is the name of the KeyHasher that made the digests
+   Journal(const std::string &file, long app_version,
+       const std::string &key_hasher,
+       const FlushPolicy &policy = FlushPolicy());
+   ~Journal();
+
+ public:
+   // replays all valid records in the journal file, returns false if the
+   // journal does not exist or is unusable (which is then deleted).
+   // |needs_rewrite| is set if the journal is in an outdated format
+   bool Replay(const RecordHandler &handler, bool *needs_rewrite);
+
+   bool Open();
+   void Close();
+   inline bool IsOpen() const;
+   void Append(char action, const std::string &sha1_key, long size,
+       int segment = -1, long offset = 0);
+   // writes the buffered records, and syncs them if the policy says so
+   void Flush();
+   void Sync();
+   // milliseconds until the buffered records are due to be written or the
+   // written ones to be synced, -1 if there is nothing to do
+   int MillisUntilDue() const;
+   void FlushIfDue();
+   Stats GetStats() const;
+
+   // records written between BeginRewrite() and CommitRewrite() replace the
+   // content of the journal, followed by the records appended in the
+   // meantime. the journal is reopened after committing
+   bool BeginRewrite();
+   void Rewrite(char action, const std::string &sha1_key, long size,
+       int segment = -1, long offset = 0);
+   bool CommitRewrite();
+
+ private:
+   // the journal is replayed from a read-only mapping of the file, each of
+   // the following consumes the bytes from |*p| up to |end| in place
+   bool ReadHeader(const char **p, const char *end, std::string *version);
+   void ReplayTextRecords(const char *p, const char *end,
+       const RecordHandler &handler);
+   std::size_t ReplayBinaryRecords(const char *p, const char *end,
+       const RecordHandler &handler);
+   void WriteHeader(std::ofstream &ofs);
+   int MillisToNextFlush() const;
+   int MillisToNextSync() const;
+
+ private:
+   using Clock = std::chrono::steady_clock;
+
+   std::string file_;
+   long app_version_;
+   std::string key_hasher_;
+   FlushPolicy policy_;
+
+   int journal_fd_;
+   std::string buffer_;
+   long buffered_count_;
+   Clock::time_point first_buffered_time_;
+   bool unsynced_;
+   Clock::time_point last_sync_time_;
+
+   std::atomic<long> record_count_;
+   std::atomic<long> flush_count_;
+   std::atomic<long> sync_count_;
+   std::atomic<long> rewrite_count_;
+
+   std::ofstream rewrite_ofstream_;
+   bool rewriting_;
+   // records appended since BeginRewrite()
+   std::string rewrite_tail_;
+};
+
+bool Journal::IsOpen() const {
+  return journal_fd_ >= 0;
+}
+
+};  // namespace lru
+
+#endif /* end of include guard: JOURNAL_H_ */
@@ -0,0 +1,226 @@
+/*******************************************************************************
+**          File: key_hasher.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 04:10 PM
+**   Description: hash functions turning the keys of DiskCache into digests
+*******************************************************************************/
+#include "key_hasher.h"
+#include <cstdint>
+#include <cstring>
+#include "common/sha1/sha1.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SHA_NI 1
+#endif
+
+namespace lru {
+
+namespace {
+
+#ifdef HAVE_SHA_NI
+  // four rounds of SHA1 with the SHA extensions. |i| is the index of the
+  // round group, E0/E1 alternate between holding the E value of the next
+  // group and saving the state for the one after. message block i + 4 is
+  // computed from block i with sha1msg1 three groups ahead, the xor two
+  // groups ahead and sha1msg2 one group ahead of being used
+  #define SHA1_NI_ROUNDS(i, E_CUR, E_NEXT) \
+    { \
+      __m128i &cur = msg[(i) % 4]; \
+      if ((i) == 0) { \
+        E_CUR = _mm_add_epi32(E_CUR, cur); \
+      } else { \
+        E_CUR = _mm_sha1nexte_epu32(E_CUR, cur); \
+      } \
+      E_NEXT = abcd; \
+      if ((i) >= 3 && (i) <= 18) { \
+        msg[((i) + 1) % 4] = _mm_sha1msg2_epu32(msg[((i) + 1) % 4], cur); \
+      } \
+      abcd = _mm_sha1rnds4_epu32(abcd, E_CUR, (i) / 5); \
+      if ((i) >= 1 && (i) <= 16) { \
+        msg[((i) + 3) % 4] = _mm_sha1msg1_epu32(msg[((i) + 3) % 4], cur); \
+      } \
+      if ((i) >= 2 && (i) <= 17) { \
+        msg[((i) + 2) % 4] = _mm_xor_si128(msg[((i) + 2) % 4], cur); \
+      } \
+    }
+
+  __attribute__((target("sha,sse4.1")))
+  void Sha1NiBlocks(uint32_t state[5], const unsigned char *data,
+      std::size_t block_count) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+        0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state));
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    __m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+    __m128i e1;
+    __m128i msg[4];
+
+    for (; block_count > 0; --block_count, data += 64) {
+      __m128i abcd_save = abcd;
+      __m128i e0_save = e0;
+
+      for (int i = 0; i < 4; ++i) {
+        msg[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+              reinterpret_cast<const __m128i *>(data + i * 16)), mask);
+      }
+
+      SHA1_NI_ROUNDS(0, e0, e1);
+      SHA1_NI_ROUNDS(1, e1, e0);
+      SHA1_NI_ROUNDS(2, e0, e1);
+      SHA1_NI_ROUNDS(3, e1, e0);
+      SHA1_NI_ROUNDS(4, e0, e1);
+      SHA1_NI_ROUNDS(5, e1, e0);
+      SHA1_NI_ROUNDS(6, e0, e1);
+      SHA1_NI_ROUNDS(7, e1, e0);
+      SHA1_NI_ROUNDS(8, e0, e1);
+      SHA1_NI_ROUNDS(9, e1, e0);
+      SHA1_NI_ROUNDS(10, e0, e1);
+      SHA1_NI_ROUNDS(11, e1, e0);
+      SHA1_NI_ROUNDS(12, e0, e1);
+      SHA1_NI_ROUNDS(13, e1, e0);
+      SHA1_NI_ROUNDS(14, e0, e1);
+      SHA1_NI_ROUNDS(15, e1, e0);
+      SHA1_NI_ROUNDS(16, e0, e1);
+      SHA1_NI_ROUNDS(17, e1, e0);
+      SHA1_NI_ROUNDS(18, e0, e1);
+      SHA1_NI_ROUNDS(19, e1, e0);
+
+      e0 = _mm_sha1nexte_epu32(e0, e0_save);
+      abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1b);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(state), abcd);
+    state[4] = _mm_extract_epi32(e0, 3);
+  }
+
+  #undef SHA1_NI_ROUNDS
+
+  void Sha1Ni(const void *data, std::size_t len, unsigned char *digest) {
+    uint32_t state[5] = {
+      0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+    };
+
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    std::size_t full_blocks = len / 64;
+    Sha1NiBlocks(state, p, full_blocks);
+
+    // the remaining bytes, the 0x80 terminator and the bit length take one
+    // or two more blocks
+    unsigned char tail[128];
+    std::size_t rest = len % 64;
+    std::memset(tail, 0, sizeof(tail));
+    std::memcpy(tail, p + full_blocks * 64, rest);
+    tail[rest] = 0x80;
+    std::size_t tail_size = rest < 56 ? 64 : 128;
+    uint64_t bit_len = static_cast<uint64_t>(len) << 3;
+    for (int i = 0; i < 8; ++i) {
+      tail[tail_size - 1 - i] = static_cast<unsigned char>(bit_len >> (i * 8));
+    }
+    Sha1NiBlocks(state, tail, tail_size / 64);
+
+    for (int i = 0; i < 20; ++i) {
+      digest[i] = static_cast<unsigned char>(state[i / 4] >> (24 - i % 4 * 8));
+    }
+  }
+#endif
+
+  void Sha1(const void *data, std::size_t len, unsigned char *digest) {
+#ifdef HAVE_SHA_NI
+    static const bool has_sha_ni = __builtin_cpu_supports("sha") &&
+      __builtin_cpu_supports("sse4.1");
+    if (has_sha_ni) {
+      Sha1Ni(data, len, digest);
+      return;
+    }
+#endif
+    sha1::calc(data, static_cast<int>(len), digest);
+  }
+
+  inline uint64_t Rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  inline uint64_t Fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+  }
+
+  // little-endian load
+  inline uint64_t Load64(const unsigned char *p) {
+    uint64_t v = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    std::memcpy(&v, p, sizeof(v));
+#else
+    for (int i = 7; i >= 0; --i) {
+      v = (v << 8) | p[i];
+    }
+#endif
+    return v;
+  }
+
+  // MurmurHash3_x64_128 by Austin Appleby, seed 0, the two halves are
+  // written little-endian
+  void Murmur3_128(const void *data, std::size_t len, unsigned char *digest) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 0;
+    uint64_t h2 = 0;
+
+    std::size_t block_count = len / 16;
+    for (std::size_t i = 0; i < block_count; ++i) {
+      uint64_t k1 = Load64(p + i * 16);
+      uint64_t k2 = Load64(p + i * 16 + 8);
+
+      k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+      h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+      k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+      h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    const unsigned char *tail = p + block_count * 16;
+    std::size_t rest = len & 15;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (std::size_t i = rest; i > 8; --i) {
+      k2 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 9) * 8);
+    }
+    if (rest > 8) {
+      k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (std::size_t i = rest < 8 ? rest : 8; i > 0; --i) {
+      k1 ^= static_cast<uint64_t>(tail[i - 1]) << ((i - 1) * 8);
+    }
+    if (rest > 0) {
+      k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = Fmix64(h1);
+    h2 = Fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    for (int i = 0; i < 8; ++i) {
+      digest[i] = static_cast<unsigned char>(h1 >> (i * 8));
+      digest[i + 8] = static_cast<unsigned char>(h2 >> (i * 8));
+    }
+  }
+};
+
+const int KeyHasher::MAX_DIGEST_SIZE;
+
+const KeyHasher SHA1_KEY_HASHER = { "sha1", 20, Sha1 };
+const KeyHasher MURMUR3_128_KEY_HASHER = { "murmur3_128", 16, Murmur3_128 };
+
+};  // namespace lru
@@ -0,0 +1,38 @@
+/*******************************************************************************
+**          File: key_hasher.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 04:10 PM
+**   Description: hash functions turning the keys of DiskCache into digests
+*******************************************************************************/
+#ifndef KEY_HASHER_H_
+#define KEY_HASHER_H_
+#include <cstddef>
+
+namespace lru {
+
+// DiskCache indexes, journals and names the cache files by the digest of a
+// key rather than the key itself. the digest must be uniformly distributed,
+// its bytes pick the shard and the hash table slot of the key
+struct KeyHasher {
+  static const int MAX_DIGEST_SIZE = 20;
+
+  // recorded in the journal, a cache is only reopened with the hasher it
+  // was built with
+  const char *name;
+  // number of bytes |hash| writes to |digest|, at most MAX_DIGEST_SIZE
+  int digest_size;
+  void (*hash)(const void *data, std::size_t len, unsigned char *digest);
+};
+
+// SHA1, the layout of every cache built before hashers were configurable.
+// computed with the SHA extensions if the CPU has them
+extern const KeyHasher SHA1_KEY_HASHER;
+
+// 128-bit MurmurHash3 (x64 variant), several times faster than SHA1 for
+// short keys. it is not cryptographic, keys crafted to collide map to the
+// same entry, so only use it for keys that cannot be chosen by an attacker
+extern const KeyHasher MURMUR3_128_KEY_HASHER;
+
+};  // namespace lru
+
+#endif /* end of include guard: KEY_HASHER_H_ */
@@ -0,0 +1,269 @@
+/*******************************************************************************
+**          File: lru_index.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 02:40 PM
+**   Description: an open-addressing hash table over an intrusive LRU list,
+**                the index of DiskCache and MemoryCache
+*******************************************************************************/
+#ifndef LRU_INDEX_H_
+#define LRU_INDEX_H_
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <functional>
+#include <utility>
+
+namespace lru {
+
+// the entries live in a slab of nodes, each node holds the key, the value
+// and the links of the LRU list as indices into the slab, so an entry costs
+// no allocation of its own and walking the list touches contiguous memory.
+// the hash table is an array of (hash, node) pairs probed linearly, a
+// lookup compares the stored hashes and only reads the nodes they match.
+//
+// nodes are referred to by handles, which stay valid until the node is
+// erased. references to keys and values are invalidated by PushFront() and
+// PushBackMarker(), which may grow the slab.
+//
+// Find() takes any type that |Hash| accepts and that compares equal to
+// Key, e.g. a string view of a string key, in which case |Hash| must give
+// it the same hash as the equal Key
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruIndex {
+ public:
+   using Handle = uint32_t;
+   using KeyType = Key;
+   using ValueType = Value;
+   static const Handle INVALID_HANDLE = UINT32_MAX;
+
+   explicit LruIndex(const Hash &hash = Hash()) :
+     hash_(hash), head_(INVALID_HANDLE), tail_(INVALID_HANDLE),
+     free_(INVALID_HANDLE), size_(0) { }
+
+ public:
+   template <typename K>
+   Handle Find(const K &key) const {
+     if (buckets_.empty()) {
+       return INVALID_HANDLE;
+     }
+
+     uint32_t hash = HashOf(key);
+     std::size_t mask = buckets_.size() - 1;
+     for (std::size_t i = hash & mask; ; i = (i + 1) & mask) {
+       const Bucket &bucket = buckets_[i];
+       if (bucket.node == INVALID_HANDLE) {
+         return INVALID_HANDLE;
+       }
+       if (bucket.hash == hash && nodes_[bucket.node].key == key) {
+         return bucket.node;
+       }
+     }
+   }
+
+   // links a new entry to the front, |key| must not be in the index yet
+   Handle PushFront(Key key, Value value) {
+     if ((size_ + 1) * 4 > buckets_.size() * 3) {
+       Rehash(buckets_.empty() ? 16 : buckets_.size() * 2);
+     }
+
+     uint32_t hash = HashOf(key);
+     Handle handle = AllocNode(std::move(key), std::move(value));
+     LinkBefore(handle, head_);
+
+     std::size_t mask = buckets_.size() - 1;
+     std::size_t i = hash & mask;
+     while (buckets_[i].node != INVALID_HANDLE) {
+       i = (i + 1) & mask;
+     }
+     buckets_[i].hash = hash;
+     buckets_[i].node = handle;
+     ++size_;
+     return handle;
+   }
+
+   // links a node to the back that Find() never returns, it marks a
+   // position in the list, which the caller moves around with MoveBefore()
+   Handle PushBackMarker(Value value) {
+     Handle handle = AllocNode(Key(), std::move(value));
+     LinkBefore(handle, INVALID_HANDLE);
+     return handle;
+   }
+
+   void Erase(Handle handle) {
+     Node &node = nodes_[handle];
+     EraseBucket(HashOf(node.key), handle);
+     Unlink(handle);
+
+     node.key = Key();
+     node.value = Value();
+     node.next = free_;
+     free_ = handle;
+   }
+
+   void MoveToFront(Handle handle) {
+     if (handle != head_) {
+       Unlink(handle);
+       LinkBefore(handle, head_);
+     }
+   }
+
+   // moves |handle| right in front of |pos|, or to the back if |pos| is
+   // INVALID_HANDLE
+   void MoveBefore(Handle handle, Handle pos) {
+     if (handle != pos && nodes_[handle].next != pos) {
+       Unlink(handle);
+       LinkBefore(handle, pos);
+     }
+   }
+
+   void Clear() {
+     buckets_.clear();
+     nodes_.clear();
+     head_ = tail_ = free_ = INVALID_HANDLE;
+     size_ = 0;
+   }
+
+   // the most and the least recently used nodes, INVALID_HANDLE if empty
+   Handle Front() const { return head_; }
+   Handle Back() const { return tail_; }
+   // the neighbours of |handle| towards the back and towards the front
+   Handle Next(Handle handle) const { return nodes_[handle].next; }
+   Handle Prev(Handle handle) const { return nodes_[handle].prev; }
+
+   const Key &KeyOf(Handle handle) const { return nodes_[handle].key; }
+   Value &ValueOf(Handle handle) { return nodes_[handle].value; }
+   const Value &ValueOf(Handle handle) const { return nodes_[handle].value; }
+
+   // number of entries, markers excluded
+   std::size_t Size() const { return size_; }
+   bool Empty() const { return size_ == 0; }
+
+ private:
+   struct Node {
+     Key key;
+     Value value;
+     Handle prev;
+     Handle next;
+   };
+
+   // |node| is INVALID_HANDLE for an empty bucket
+   struct Bucket {
+     uint32_t hash;
+     Handle node;
+   };
+
+   template <typename K>
+   uint32_t HashOf(const K &key) const {
+     return static_cast<uint32_t>(hash_(key));
+   }
+
+   Handle AllocNode(Key &&key, Value &&value) {
+     Handle handle = free_;
+     if (handle != INVALID_HANDLE) {
+       free_ = nodes_[handle].next;
+       nodes_[handle].key = std::move(key);
+       nodes_[handle].value = std::move(value);
+     } else {
+       handle = static_cast<Handle>(nodes_.size());
+       nodes_.push_back(Node{std::move(key), std::move(value), INVALID_HANDLE,
+           INVALID_HANDLE});
+     }
+     return handle;
+   }
+
+   void LinkBefore(Handle handle, Handle pos) {
+     Node &node = nodes_[handle];
+     node.next = pos;
+     node.prev = pos == INVALID_HANDLE ? tail_ : nodes_[pos].prev;
+
+     if (node.prev == INVALID_HANDLE) {
+       head_ = handle;
+     } else {
+       nodes_[node.prev].next = handle;
+     }
+     if (pos == INVALID_HANDLE) {
+       tail_ = handle;
+     } else {
+       nodes_[pos].prev = handle;
+     }
+   }
+
+   void Unlink(Handle handle) {
+     Node &node = nodes_[handle];
+     if (node.prev == INVALID_HANDLE) {
+       head_ = node.next;
+     } else {
+       nodes_[node.prev].next = node.next;
+     }
+     if (node.next == INVALID_HANDLE) {
+       tail_ = node.prev;
+     } else {
+       nodes_[node.next].prev = node.prev;
+     }
+   }
+
+   // removes the bucket of |handle| if there is one, which is not the case
+   // for a marker, and shifts back the buckets probed past it so no
+   // tombstones are needed
+   void EraseBucket(uint32_t hash, Handle handle) {
+     if (buckets_.empty()) {
+       return;
+     }
+
+     std::size_t mask = buckets_.size() - 1;
+     std::size_t i = hash & mask;
+     while (buckets_[i].node != handle) {
+       if (buckets_[i].node == INVALID_HANDLE) {
+         return;
+       }
+       i = (i + 1) & mask;
+     }
+
+     std::size_t hole = i;
+     for (std::size_t j = (i + 1) & mask; buckets_[j].node != INVALID_HANDLE;
+         j = (j + 1) & mask) {
+       // a bucket may fill the hole unless its home lies cyclically in
+       // (hole, j]
+       std::size_t home = buckets_[j].hash & mask;
+       if (((j - home) & mask) >= ((j - hole) & mask)) {
+         buckets_[hole] = buckets_[j];
+         hole = j;
+       }
+     }
+     buckets_[hole].node = INVALID_HANDLE;
+     --size_;
+   }
+
+   void Rehash(std::size_t bucket_count) {
+     std::vector<Bucket> buckets(bucket_count, Bucket{0, INVALID_HANDLE});
+     std::size_t mask = bucket_count - 1;
+     for (const Bucket &bucket : buckets_) {
+       if (bucket.node != INVALID_HANDLE) {
+         std::size_t i = bucket.hash & mask;
+         while (buckets[i].node != INVALID_HANDLE) {
+           i = (i + 1) & mask;
+         }
+         buckets[i] = bucket;
+       }
+     }
+     buckets_.swap(buckets);
+   }
+
+ private:
+   Hash hash_;
+   std::vector<Bucket> buckets_;
+   std::vector<Node> nodes_;
+   Handle head_;
+   Handle tail_;
+   // erased nodes, chained through |next|
+   Handle free_;
+   std::size_t size_;
+};
+
+template <typename Key, typename Value, typename Hash>
+const typename LruIndex<Key, Value, Hash>::Handle
+  LruIndex<Key, Value, Hash>::INVALID_HANDLE;
+
+};  // namespace lru
+
+#endif /* end of include guard: LRU_INDEX_H_ */
@@ -10,16 +10,24 @@
 namespace lru {
 
   namespace {
-    const float RETAIN_RATIO = 0.75f;
+    // entries a Put() evicts at most between the watermarks
+    const std::size_t EVICTION_BATCH_SIZE = 16;
   };
 
   MemoryCache::MemoryCache(long max_cache_size, 
       long max_item_count, 
       SizeCalculator size_calculator,
-      EvictionHandler eviction_handler) : 
+      EvictionHandler eviction_handler,
+      EvictionPolicy eviction_policy,
+      float eviction_high_watermark,
+      float eviction_low_watermark) : 
+    evictor_(&entries_, eviction_policy),
     max_cache_size_(max_cache_size),
     max_item_count_(max_item_count), 
     cur_cache_size_(0),
+    eviction_high_watermark_(eviction_high_watermark),
+    eviction_low_watermark_(eviction_low_watermark),
+    evicting_(false),
     calculate_obj_size(size_calculator),
     on_obj_evicted(eviction_handler) {
 
@@ -27,98 +35,132 @@ namespace lru {
 void *MemoryCache::Get(const std::string &key) {
   std::lock_guard<std::mutex> lock(mutex_);
 
-  auto iter = entry_map_.find(key);
-  if (iter != entry_map_.end()) {
-    // move item to front
-    entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-    iter->second = entry_list_.begin();
+  EntryIndex::Handle handle = entries_.Find(key);
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    evictor_.OnHit(handle);
 
-    return iter->second->second;
+    return entries_.ValueOf(handle).value;
   }
 
   return nullptr;
 }
 
 void MemoryCache::Put(const std::string &key, void *value) {
-  std::lock_guard<std::mutex> lock(mutex_);
+  EvictedEntries evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PutInternal(key, value);
+    EvictIfNeeded(&evicted);
+  }
+
+  for (auto &entry : evicted) {
+    on_obj_evicted(entry.first, entry.second);
+  }
+}
 
+void MemoryCache::PutInternal(const std::string &key, void *value) {
   void *old_value = nullptr;
 
-  auto iter = entry_map_.find(key);
-  if (iter != entry_map_.end()) {
-    old_value = iter->second->second;
+  EntryIndex::Handle handle = entries_.Find(key);
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    old_value = entries_.ValueOf(handle).value;
     cur_cache_size_ -= calculate_obj_size(key, old_value);
     on_obj_evicted(key, old_value);
 
-    entry_list_.splice(entry_list_.begin(), entry_list_, iter->second); 
-    iter->second = entry_list_.begin();
-    iter->second->second = value;
+    evictor_.OnHit(handle);
+    entries_.ValueOf(handle).value = value;
 
     LOG_V("lru::MemoryCache", "replaced the old key: %s", key.c_str());
 
   } else {
-    entry_list_.emplace_front(key, value);
-    entry_map_.emplace(key, entry_list_.begin());
+    handle = entries_.PushFront(key, Entry(value));
+    evictor_.OnInsert(handle);
   }
 
   cur_cache_size_ += calculate_obj_size(key, value);
-
-  EvictIfNeeded();
 }
 
 void MemoryCache::Remove(const std::string &key) {
   std::lock_guard<std::mutex> lock(mutex_);
-  RemoveInternal(key);
+
+  EntryIndex::Handle handle = entries_.Find(key);
+  if (handle != EntryIndex::INVALID_HANDLE) {
+    RemoveInternal(handle);
+  }
 }
 
 void MemoryCache::EvictAll() {
-  std::lock_guard<std::mutex> lock(mutex_);
+  EvictedEntries evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
 
-  LOG_D("lru::MemoryCache", "going to evict all, entries: %zd, size: %ld", 
-      entry_list_.size(), cur_cache_size_);
+    LOG_D("lru::MemoryCache", "going to evict all, entries: %zd, size: %ld", 
+        entries_.Size(), cur_cache_size_);
 
-  while (cur_cache_size_ > 0) {
-    auto &item = entry_list_.back();    
-    RemoveInternal(item.first);
+    evictor_.Evict([this]{ return cur_cache_size_ > 0; },
+        [this, &evicted](EntryIndex::Handle handle){
+          RemoveInternal(handle, &evicted);
+        });
+    evicting_ = false;
+
+    LOG_D("lru::MemoryCache", "after eviction, entries: %zd, size: %ld", 
+        entries_.Size(), cur_cache_size_);
   }
 
-  LOG_D("lru::MemoryCache", "after eviction, entries: %zd, size: %ld", 
-      entry_list_.size(), cur_cache_size_);
+  for (auto &entry : evicted) {
+    on_obj_evicted(entry.first, entry.second);
+  }
 }
 
-void MemoryCache::EvictIfNeeded() {
-  if (cur_cache_size_ > max_cache_size_ || 
-      entry_list_.size() > max_item_count_) {
-
-    LOG_D("lru::MemoryCache", "start eviction, entries: %zd, size: %zd", 
-        entry_list_.size(), cur_cache_size_);
-
-    long target_size = max_cache_size_ * RETAIN_RATIO;
-    long target_count = max_item_count_ * RETAIN_RATIO;
-
-    while (cur_cache_size_ > target_size || 
-        entry_list_.size() > target_count) {
-
-      auto &item = entry_list_.back();    
-      RemoveInternal(item.first);
+void MemoryCache::EvictIfNeeded(EvictedEntries *evicted) {
+  if (!evicting_) {
+    if (cur_cache_size_ <= max_cache_size_ * eviction_high_watermark_ &&
+        static_cast<long>(entries_.Size()) <=
+        max_item_count_ * eviction_high_watermark_) {
+      return;
     }
 
+    LOG_D("lru::MemoryCache", "start eviction, entries: %zd, size: %ld", 
+        entries_.Size(), cur_cache_size_);
+    evicting_ = true;
+  }
+
+  evictor_.Evict([this, evicted]{
+        return cur_cache_size_ > max_cache_size_ ||
+          static_cast<long>(entries_.Size()) > max_item_count_ ||
+          (evicted->size() < EVICTION_BATCH_SIZE && IsOverTarget());
+      },
+      [this, evicted](EntryIndex::Handle handle){
+        RemoveInternal(handle, evicted);
+      });
+
+  if (!IsOverTarget()) {
+    evicting_ = false;
     LOG_D("lru::MemoryCache", "after eviction, entries: %zd, size: %ld", 
-        entry_list_.size(), cur_cache_size_);
+        entries_.Size(), cur_cache_size_);
   }
 }
 
-void MemoryCache::RemoveInternal(const std::string &key) {
-  auto iter = entry_map_.find(key);
-  if (iter != entry_map_.end()) {
-    void *value = iter->second->second;
+bool MemoryCache::IsOverTarget() const {
+  return cur_cache_size_ > max_cache_size_ * eviction_low_watermark_ ||
+    static_cast<long>(entries_.Size()) >
+    max_item_count_ * eviction_low_watermark_;
+}
 
-    cur_cache_size_ -= calculate_obj_size(key, value);
-    on_obj_evicted(key, value);
+void MemoryCache::RemoveInternal(EntryIndex::Handle handle,
+    EvictedEntries *evicted) {
+  const std::string &key = entries_.KeyOf(handle);
+  void *value = entries_.ValueOf(handle).value;
 
-    entry_list_.erase(iter->second);
-    entry_map_.erase(iter);
+  cur_cache_size_ -= calculate_obj_size(key, value);
+  if (evicted) {
+    evicted->emplace_back(key, value);
+  } else {
+    on_obj_evicted(key, value);
   }
+
+  evictor_.OnErase(handle);
+  entries_.Erase(handle);
 }
 
 }; // namespace lru
@@ -7,10 +7,13 @@
 #ifndef MEMORY_CACHE_H_
 #define MEMORY_CACHE_H_
 #include <string>
-#include <map>
-#include <list>
+#include <vector>
+#include <utility>
+#include <functional>
 #include <mutex>
 #include <condition_variable>
+#include "lru/evictor.h"
+#include "lru/lru_index.h"
 
 namespace lru {
 
@@ -20,10 +23,19 @@ class MemoryCache {
    using EvictionHandler = std::function<void(const std::string &key, void *value)>;
 
  public:
+   // eviction starts once the cache size or the item count exceeds
+   // |eviction_high_watermark| of its limit, from then on every Put()
+   // evicts a small batch of entries until both are below
+   // |eviction_low_watermark| of their limits, and as many more as it takes
+   // to stay within the limits. |eviction_handler| is called for evicted
+   // entries after the lock is released
    MemoryCache(long max_cache_size, 
        long max_item_count, 
        SizeCalculator size_calculator,
-       EvictionHandler eviction_handler);
+       EvictionHandler eviction_handler,
+       EvictionPolicy eviction_policy = EvictionPolicy::LRU,
+       float eviction_high_watermark = 1.0f,
+       float eviction_low_watermark = 0.95f);
    ~MemoryCache() = default;
 
  public:
@@ -38,19 +50,39 @@ class MemoryCache {
    inline long MaxCacheSize() const;
 
  private:
-   void EvictIfNeeded();
-   void RemoveInternal(const std::string &key);
+   // |region| belongs to |evictor_|
+   struct Entry {
+     void *value;
+     unsigned char region;
+
+     Entry() : value(nullptr), region(0) { }
+     explicit Entry(void *value) : value(value), region(0) { }
+   };
+   using EntryIndex = LruIndex<std::string, Entry>;
+   using EntryEvictor = Evictor<EntryIndex, std::hash<std::string>>;
+   using EvictedEntries = std::vector<std::pair<std::string, void *>>;
+
+   void PutInternal(const std::string &key, void *value);
+   void EvictIfNeeded(EvictedEntries *evicted);
+   bool IsOverTarget() const;
+   // calls the eviction handler with the entry, or adds the entry to
+   // |evicted| for the caller to call it after unlocking
+   void RemoveInternal(EntryIndex::Handle handle,
+       EvictedEntries *evicted = nullptr);
 
  private:
-   using ListElement = std::pair<std::string, void *>;
-   using EntryIterator = std::map<std::string, std::list<ListElement>::iterator>::iterator;
-   std::map<std::string, std::list<ListElement>::iterator> entry_map_;
-   std::list<ListElement> entry_list_;
+   // most recently used entries first, ordered by |evictor_|
+   EntryIndex entries_;
+   EntryEvictor evictor_;
 
  private:
    long max_cache_size_;
    long max_item_count_;
    long cur_cache_size_;
+   float eviction_high_watermark_;
+   float eviction_low_watermark_;
+   // set from crossing the high watermark to getting below the low one
+   bool evicting_;
    SizeCalculator calculate_obj_size;
    EvictionHandler on_obj_evicted;
 
@@ -59,7 +91,7 @@ class MemoryCache {
 };  // class MemoryCache
 
 long MemoryCache::ItemCount() const {
-  return entry_list_.size();
+  return entries_.Size();
 }
 
 long MemoryCache::MaxItemCount() const {
@@ -0,0 +1,226 @@
+/*******************************************************************************
+**          File: segment_store.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 10:20 AM
+**   Description: append-only segment files holding the packed entries of
+**                DiskCache
+*******************************************************************************/
+#include "segment_store.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "common/file_util.h"
+#include "lru/file_reaper.h"
+#include "log/log.h"
+
+namespace lru {
+
+SegmentStore::SegmentStore(const std::string &dir, long max_segment_size,
+    FileReaper *reaper) :
+  dir_(dir),
+  max_segment_size_(max_segment_size),
+  reaper_(reaper),
+  active_segment_(-1),
+  active_fd_(-1) {
+}
+
+SegmentStore::~SegmentStore() {
+  if (active_fd_ >= 0) {
+    ::close(active_fd_);
+  }
+}
+
+bool SegmentStore::Open() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  // created along with the first segment
+  if (!FileUtil::DirExists(dir_)) {
+    return true;
+  }
+
+  DIR *dir = ::opendir(dir_.c_str());
+  if (!dir) {
+    LOG_E("lru::SegmentStore", "failed to open dir %s: %s", dir_.c_str(),
+        strerror(errno));
+    return false;
+  }
+
+  struct dirent *ent;
+  while ((ent = ::readdir(dir)) != nullptr) {
+    char *end;
+    long id = std::strtol(ent->d_name, &end, 10);
+    if (end == ent->d_name || *end != '\0' || id < 0) {
+      continue;
+    }
+
+    long size = FileUtil::GetFileSize(GetSegmentFile(id));
+    if (size >= 0) {
+      segments_[id].size = size;
+    }
+  }
+  ::closedir(dir);
+
+  LOG_V("lru::SegmentStore", "found %zd segments in %s", segments_.size(),
+      dir_.c_str());
+  return true;
+}
+
+bool SegmentStore::Append(const void *data, std::size_t len, int *segment,
+    long *offset) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (active_fd_ < 0 ||
+      (segments_[active_segment_].size > 0 &&
+       segments_[active_segment_].size + (long)len > max_segment_size_)) {
+    if (!StartSegment()) {
+      return false;
+    }
+  }
+
+  Segment &active = segments_[active_segment_];
+  const char *p = static_cast<const char *>(data);
+  std::size_t written = 0;
+  while (written < len) {
+    ssize_t n = ::pwrite(active_fd_, p + written, len - written,
+        active.size + written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      // the partially written bytes are overwritten by the next append
+      LOG_E("lru::SegmentStore", "failed to append to segment %d: %s",
+          active_segment_, strerror(errno));
+      return false;
+    }
+    written += n;
+  }
+
+  *segment = active_segment_;
+  *offset = active.size;
+  active.size += len;
+  ++active.pin_count;
+  return true;
+}
+
+void SegmentStore::Unpin(int segment) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = segments_.find(segment);
+  if (iter != segments_.end()) {
+    --iter->second.pin_count;
+  }
+}
+
+std::string SegmentStore::GetSegmentFile(int segment) const {
+  return dir_ + "/" + std::to_string(segment);
+}
+
+void SegmentStore::AddLive(int segment, long size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = segments_.find(segment);
+  if (iter != segments_.end()) {
+    iter->second.live_size += size;
+  }
+}
+
+void SegmentStore::RemoveLive(int segment, long size) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = segments_.find(segment);
+  if (iter != segments_.end()) {
+    iter->second.live_size -= size;
+  }
+}
+
+int SegmentStore::PickSegmentToCompact(float min_live_ratio) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto &entry : segments_) {
+    Segment &seg = entry.second;
+    if (entry.first != active_segment_ && !seg.compacting &&
+        seg.pin_count == 0 && seg.live_size < seg.size * min_live_ratio) {
+      seg.compacting = true;
+      return entry.first;
+    }
+  }
+
+  return -1;
+}
+
+bool SegmentStore::DeleteSegmentIfDead(int segment) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto iter = segments_.find(segment);
+  if (iter == segments_.end()) {
+    return false;
+  }
+
+  iter->second.compacting = false;
+  if (iter->second.live_size > 0 || iter->second.pin_count > 0) {
+    return false;
+  }
+
+  DeleteSegment(segment);
+  return true;
+}
+
+void SegmentStore::DeleteDeadSegments() {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<int> dead_segments;
+  for (auto &entry : segments_) {
+    if (entry.first != active_segment_ && entry.second.live_size <= 0 &&
+        entry.second.pin_count == 0) {
+      dead_segments.push_back(entry.first);
+    }
+  }
+
+  for (int segment : dead_segments) {
+    DeleteSegment(segment);
+  }
+}
+
+bool SegmentStore::StartSegment() {
+  if (active_fd_ < 0 && !FileUtil::DirExists(dir_) &&
+      !FileUtil::MakeDirs(dir_)) {
+    LOG_E("lru::SegmentStore", "failed to create dir: %s", dir_.c_str());
+    return false;
+  }
+
+  int segment = segments_.empty() ? 0 : segments_.rbegin()->first + 1;
+  std::string file = GetSegmentFile(segment);
+
+  int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+      0644);
+  if (fd < 0) {
+    LOG_E("lru::SegmentStore", "failed to create segment %s: %s",
+        file.c_str(), strerror(errno));
+    return false;
+  }
+
+  if (active_fd_ >= 0) {
+    ::close(active_fd_);
+  }
+  active_fd_ = fd;
+  active_segment_ = segment;
+  segments_[segment] = Segment();
+
+  LOG_V("lru::SegmentStore", "started segment %s", file.c_str());
+  return true;
+}
+
+void SegmentStore::DeleteSegment(int segment) {
+  LOG_V("lru::SegmentStore", "deleting segment %d, size=%ld", segment,
+      segments_[segment].size);
+
+  if (reaper_) {
+    reaper_->Dispose(GetSegmentFile(segment));
+  } else {
+    FileUtil::DeleteFile(GetSegmentFile(segment));
+  }
+  segments_.erase(segment);
+}
+
+};  // namespace lru
@@ -0,0 +1,94 @@
+/*******************************************************************************
+**          File: segment_store.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 10:20 AM
+**   Description: append-only segment files holding the packed entries of
+**                DiskCache
+*******************************************************************************/
+#ifndef SEGMENT_STORE_H_
+#define SEGMENT_STORE_H_
+#include <string>
+#include <map>
+#include <mutex>
+
+namespace lru {
+
+class FileReaper;
+
+// small values are appended to segment files named by their numeric id in
+// |dir|, the caller keeps the index of where every value lives. space of
+// removed or overwritten values is only reclaimed by compacting a segment,
+// which means copying its live values elsewhere and deleting it.
+//
+// the store only counts the bytes that are live in every segment, it is
+// up to the caller to report them with AddLive() and RemoveLive().
+//
+// every append pins its segment until the caller calls Unpin() once the
+// value is in its index, a pinned segment is neither compacted nor
+// deleted, since its live bytes do not count the value yet.
+//
+// deleted segments are handed to |reaper| if given, which must outlive the
+// store.
+class SegmentStore {
+ public:
+   SegmentStore(const std::string &dir, long max_segment_size,
+       FileReaper *reaper = nullptr);
+   ~SegmentStore();
+
+   SegmentStore(const SegmentStore &) = delete;
+   SegmentStore &operator=(const SegmentStore &) = delete;
+
+ public:
+   // picks up the segments found in |dir|, they are all sealed, new values
+   // always go to a fresh segment. |dir| is created on the first append
+   bool Open();
+
+   // appends |len| bytes to the active segment, a new segment is started
+   // when the active one would grow past the max segment size. on success
+   // |segment| is pinned
+   bool Append(const void *data, std::size_t len, int *segment,
+       long *offset);
+   void Unpin(int segment);
+   std::string GetSegmentFile(int segment) const;
+
+   void AddLive(int segment, long size);
+   void RemoveLive(int segment, long size);
+
+   // returns a sealed and unpinned segment whose live bytes are less than
+   // |min_live_ratio| of its size and marks it as being compacted, or -1
+   // if there is none
+   int PickSegmentToCompact(float min_live_ratio);
+   // deletes |segment| when none of its bytes are live and it is not
+   // pinned, otherwise it can be picked for compaction again
+   bool DeleteSegmentIfDead(int segment);
+   // deletes every sealed and unpinned segment without live bytes
+   void DeleteDeadSegments();
+
+ private:
+   struct Segment {
+     long size;
+     long live_size;
+     int pin_count;
+     bool compacting;
+
+     Segment() : size(0), live_size(0), pin_count(0), compacting(false) { }
+   };
+
+   bool StartSegment();
+   void DeleteSegment(int segment);
+
+ private:
+   std::string dir_;
+   long max_segment_size_;
+   FileReaper *reaper_;
+
+   std::map<int, Segment> segments_;
+   int active_segment_;
+   int active_fd_;
+
+   std::mutex mutex_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: SEGMENT_STORE_H_ */
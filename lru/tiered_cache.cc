@@ -0,0 +1,239 @@
+/*******************************************************************************
+**          File: tiered_cache.cc
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:20 AM
+**   Description: a MemoryCache in front of a DiskCache
+*******************************************************************************/
+#include "tiered_cache.h"
+#include <chrono>
+#include <iterator>
+#include "log/log.h"
+
+namespace lru {
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  long ElapsedNs(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        Clock::now() - start).count();
+  }
+};
+
+TieredCache::TieredCache(DiskCache *disk_cache, long max_memory_size,
+    long max_memory_item_count, const Options &options) :
+  disk_(disk_cache),
+  write_back_(options.write_back),
+  write_seq_(0),
+  memory_hit_count_(0),
+  disk_hit_count_(0),
+  miss_count_(0),
+  memory_hit_ns_(0),
+  disk_hit_ns_(0),
+  miss_ns_(0),
+  promotion_count_(0),
+  demotion_count_(0) {
+
+  memory_.reset(new MemoryCache(max_memory_size, max_memory_item_count,
+        [](const std::string &key, void *value) {
+          return key.size() + static_cast<Slot *>(value)->data->size();
+        },
+        [this](const std::string &key, void *value) {
+          OnMemoryEvicted(key, value);
+        },
+        options.eviction_policy, options.eviction_high_watermark,
+        options.eviction_low_watermark));
+
+  if (write_back_) {
+    demotion_thread_ = std::thread(&TieredCache::RunDemotions, this);
+  }
+}
+
+TieredCache::~TieredCache() {
+  {
+    // frees the slots, and queues the dirty ones for writing
+    std::lock_guard<std::mutex> lock(mutex_);
+    memory_->EvictAll();
+  }
+
+  demotions_.QuitBlocking();
+  if (demotion_thread_.joinable()) {
+    demotion_thread_.join();
+  }
+
+  LOG_D("lru::TieredCache", "memory hits: %ld, disk hits: %ld, misses: %ld, "
+      "demotions: %ld", memory_hit_count_.load(), disk_hit_count_.load(),
+      miss_count_.load(), demotion_count_.load());
+}
+
+bool TieredCache::Get(const std::string &key, std::string *value) {
+  auto start = Clock::now();
+
+  unsigned long seq = 0;
+  bool in_memory = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Slot *slot = static_cast<Slot *>(memory_->Get(key));
+    if (slot) {
+      *value = *slot->data;
+
+    } else {
+      auto it = pending_.find(key);
+      if (it != pending_.end()) {
+        // still dirty, back to memory instead of being written to disk
+        *value = *it->second;
+        slot = new Slot(std::move(it->second), true);
+        pending_.erase(it);
+        memory_->Put(key, slot);
+
+      } else {
+        in_memory = false;
+        seq = write_seq_;
+      }
+    }
+  }
+
+  if (in_memory) {
+    ++memory_hit_count_;
+    memory_hit_ns_ += ElapsedNs(start);
+    return true;
+  }
+
+  std::string data;
+  bool found = disk_->GetStream(key, [&data](std::istream &fin) {
+    data.assign(std::istreambuf_iterator<char>(fin),
+        std::istreambuf_iterator<char>());
+    return !fin.bad();
+  });
+
+  if (!found) {
+    ++miss_count_;
+    miss_ns_ += ElapsedNs(start);
+    return false;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // a Put() or Remove() of the key may have got in while reading, and
+    // another Get() may have promoted it already
+    if (seq == write_seq_ && !memory_->Get(key)) {
+      memory_->Put(key, new Slot(std::make_shared<const std::string>(data),
+            false));
+      ++promotion_count_;
+    }
+  }
+
+  *value = std::move(data);
+  ++disk_hit_count_;
+  disk_hit_ns_ += ElapsedNs(start);
+  return true;
+}
+
+void TieredCache::Put(const std::string &key, std::string value) {
+  std::shared_ptr<const std::string> data(
+      std::make_shared<const std::string>(std::move(value)));
+
+  if (write_back_) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++write_seq_;
+    pending_.erase(key);
+    ForgetDirtyValue(key);
+    memory_->Put(key, new Slot(std::move(data), true));
+    return;
+  }
+
+  std::lock_guard<std::mutex> write_lock(WriteMutexOf(key));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++write_seq_;
+    memory_->Put(key, new Slot(data, false));
+  }
+  disk_->Put(key, data->data(), data->size());
+}
+
+void TieredCache::Remove(const std::string &key) {
+  std::lock_guard<std::mutex> write_lock(WriteMutexOf(key));
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++write_seq_;
+    pending_.erase(key);
+    ForgetDirtyValue(key);
+    memory_->Remove(key);
+  }
+  disk_->Remove(key);
+}
+
+TieredCache::Stats TieredCache::GetStats() const {
+  Stats stats;
+  stats.memory_hit_count = memory_hit_count_;
+  stats.disk_hit_count = disk_hit_count_;
+  stats.miss_count = miss_count_;
+  stats.memory_hit_ns = memory_hit_ns_;
+  stats.disk_hit_ns = disk_hit_ns_;
+  stats.miss_ns = miss_ns_;
+  stats.promotion_count = promotion_count_;
+  stats.demotion_count = demotion_count_;
+  return stats;
+}
+
+long TieredCache::MemoryItemCount() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_->ItemCount();
+}
+
+long TieredCache::MemoryCacheSize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return memory_->CurrentCacheSize();
+}
+
+void TieredCache::OnMemoryEvicted(const std::string &key, void *value) {
+  std::unique_ptr<Slot> slot(static_cast<Slot *>(value));
+  if (slot->dirty) {
+    pending_[key] = std::move(slot->data);
+    demotions_.PushBack(key);
+  }
+}
+
+void TieredCache::ForgetDirtyValue(const std::string &key) {
+  Slot *slot = static_cast<Slot *>(memory_->Get(key));
+  if (slot) {
+    slot->dirty = false;
+  }
+}
+
+// a key may be queued more than once, or its write cancelled, the value in
+// |pending_| is what gets written if there is any
+void TieredCache::RunDemotions() {
+  std::string key;
+  while (demotions_.TakeFront(&key)) {
+    std::lock_guard<std::mutex> write_lock(WriteMutexOf(key));
+
+    std::shared_ptr<const std::string> data;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = pending_.find(key);
+      if (it == pending_.end()) {
+        continue;
+      }
+      data = it->second;
+    }
+
+    disk_->Put(key, data->data(), data->size());
+    ++demotion_count_;
+
+    // served from |pending_| until it is on disk
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = pending_.find(key);
+    if (it != pending_.end() && it->second == data) {
+      pending_.erase(it);
+    }
+  }
+}
+
+std::mutex &TieredCache::WriteMutexOf(const std::string &key) {
+  return write_mutexes_[std::hash<std::string>()(key) % WRITE_MUTEX_COUNT];
+}
+
+};  // namespace lru
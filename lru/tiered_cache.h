@@ -0,0 +1,130 @@
+/*******************************************************************************
+**          File: tiered_cache.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 01:20 AM
+**   Description: a MemoryCache in front of a DiskCache
+*******************************************************************************/
+#ifndef TIERED_CACHE_H_
+#define TIERED_CACHE_H_
+#include <string>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <unordered_map>
+#include "common/blocking_queue.h"
+#include "lru/disk_cache.h"
+#include "lru/memory_cache.h"
+
+namespace lru {
+
+// values are byte strings, served from memory if they are there, else read
+// from |disk_cache| and promoted to memory. the size of an entry in memory
+// is the bytes of its key and value.
+//
+// by default Put() writes both tiers and entries evicted from memory are
+// just freed. with |write_back|, Put() only writes memory, entries evicted
+// from memory are written to disk on a background thread, and the entries
+// still in memory are written when the TieredCache is destroyed, so
+// |disk_cache| must outlive it. entries waiting to be written are still
+// served, and a Put() or Remove() of their key cancels the write.
+class TieredCache {
+ public:
+   struct Options {
+     EvictionPolicy eviction_policy;
+     float eviction_high_watermark;
+     float eviction_low_watermark;
+     bool write_back;
+
+     Options() : eviction_policy(EvictionPolicy::LRU),
+       eviction_high_watermark(1.0f), eviction_low_watermark(0.95f),
+       write_back(false) { }
+   };
+
+   // every Get() counts as one of the three outcomes, the time spent in
+   // them is summed up per outcome
+   struct Stats {
+     long memory_hit_count;
+     long disk_hit_count;
+     long miss_count;
+     long memory_hit_ns;
+     long disk_hit_ns;
+     long miss_ns;
+     long promotion_count;  // disk hits copied to memory
+     long demotion_count;   // evicted entries written to disk
+
+     Stats() : memory_hit_count(0), disk_hit_count(0), miss_count(0),
+       memory_hit_ns(0), disk_hit_ns(0), miss_ns(0), promotion_count(0),
+       demotion_count(0) { }
+   };
+
+   TieredCache(DiskCache *disk_cache, long max_memory_size,
+       long max_memory_item_count, const Options &options = Options());
+   ~TieredCache();
+
+   TieredCache(const TieredCache &) = delete;
+   TieredCache &operator=(const TieredCache &) = delete;
+
+ public:
+   bool Get(const std::string &key, std::string *value);
+   void Put(const std::string &key, std::string value);
+   void Remove(const std::string &key);
+   Stats GetStats() const;
+   long MemoryItemCount() const;
+   long MemoryCacheSize() const;
+
+ private:
+   // the value of an entry in memory, |dirty| if it is not on disk
+   struct Slot {
+     std::shared_ptr<const std::string> data;
+     bool dirty;
+
+     Slot(std::shared_ptr<const std::string> data, bool dirty) :
+       data(std::move(data)), dirty(dirty) { }
+   };
+
+   // called by |memory_| with |mutex_| held
+   void OnMemoryEvicted(const std::string &key, void *value);
+   // marks the entry of |key| in memory clean before it is replaced or
+   // removed, so that it is not written to disk
+   void ForgetDirtyValue(const std::string &key);
+   void RunDemotions();
+   std::mutex &WriteMutexOf(const std::string &key);
+
+ private:
+   static const int WRITE_MUTEX_COUNT = 16;
+
+   DiskCache *disk_;
+   bool write_back_;
+   std::unique_ptr<MemoryCache> memory_;
+
+   // guards |memory_| and |pending_|, |memory_| takes a lock of its own,
+   // but eviction and lookups have to be atomic with |pending_|
+   mutable std::mutex mutex_;
+   // values evicted from memory and waiting to be written to disk
+   std::unordered_map<std::string, std::shared_ptr<const std::string>>
+     pending_;
+   // bumped by every Put() and Remove(), a Get() does not promote what it
+   // read from disk if it changed in the meantime
+   unsigned long write_seq_;
+
+   // writes of a key to disk, and its removal, are serialized by one of
+   // these, so a late demotion cannot overwrite a newer value
+   std::mutex write_mutexes_[WRITE_MUTEX_COUNT];
+
+   BlockingQueue<std::string> demotions_;
+   std::thread demotion_thread_;
+
+   std::atomic<long> memory_hit_count_;
+   std::atomic<long> disk_hit_count_;
+   std::atomic<long> miss_count_;
+   std::atomic<long> memory_hit_ns_;
+   std::atomic<long> disk_hit_ns_;
+   std::atomic<long> miss_ns_;
+   std::atomic<long> promotion_count_;
+   std::atomic<long> demotion_count_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: TIERED_CACHE_H_ */
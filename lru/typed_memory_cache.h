@@ -0,0 +1,229 @@
+/*******************************************************************************
+**          File: typed_memory_cache.h
+**        Author: neevek <i@neevek.net>.
+** Creation Time: 2026-10-17 Sat 06:20 PM
+**   Description: a MemoryCache holding values of a fixed type by value
+*******************************************************************************/
+#ifndef TYPED_MEMORY_CACHE_H_
+#define TYPED_MEMORY_CACHE_H_
+#include <string>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <mutex>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#include "lru/lru_index.h"
+
+namespace lru {
+
+// counts every entry as 1, the cache size is then the item count
+struct UnitSize {
+  template <typename K, typename V>
+  std::size_t operator()(const K &, const V &) const {
+    return 1;
+  }
+};
+
+// hashes std::string keys, and string views the same way, so a cache with
+// string keys can be searched without making a string
+struct StringHash {
+  std::size_t operator()(const std::string &key) const {
+#if __cplusplus >= 201703L
+    return std::hash<std::string_view>()(key);
+#else
+    return std::hash<std::string>()(key);
+#endif
+  }
+
+#if __cplusplus >= 201703L
+  std::size_t operator()(std::string_view key) const {
+    return std::hash<std::string_view>()(key);
+  }
+
+  std::size_t operator()(const char *key) const {
+    return std::hash<std::string_view>()(key);
+  }
+#endif
+};
+
+template <typename K>
+using DefaultKeyHash = typename std::conditional<
+  std::is_same<K, std::string>::value, StringHash, std::hash<K>>::type;
+
+// unlike MemoryCache, values are moved into the cache and destroyed when
+// they are evicted or removed, and the size of an entry is computed by
+// |SizeFn|, a functor called as size_fn(key, value), which is known at
+// compile time. values shared with the callers go in as std::shared_ptr.
+//
+// Get(), Visit() and Remove() take anything that |Hash| hashes like the
+// equal K, e.g. a std::string_view for std::string keys with C++17
+template <typename K, typename V, typename SizeFn = UnitSize,
+         typename Hash = DefaultKeyHash<K>>
+class TypedMemoryCache {
+ public:
+   TypedMemoryCache(long max_cache_size, long max_item_count,
+       const SizeFn &size_fn = SizeFn(),
+       float eviction_high_watermark = 1.0f,
+       float eviction_low_watermark = 0.95f) :
+     max_cache_size_(max_cache_size),
+     max_item_count_(max_item_count),
+     cur_cache_size_(0),
+     eviction_high_watermark_(eviction_high_watermark),
+     eviction_low_watermark_(eviction_low_watermark),
+     evicting_(false),
+     size_fn_(size_fn) { }
+
+   TypedMemoryCache(const TypedMemoryCache &) = delete;
+   TypedMemoryCache &operator=(const TypedMemoryCache &) = delete;
+
+ public:
+   // copies the value of |key| to |value| and promotes the entry
+   template <typename KeyLike>
+   bool Get(const KeyLike &key, V *value) {
+     return Visit(key, [value](const V &v) { *value = v; });
+   }
+
+   // calls |fun| with the value of |key| while the cache is locked, the
+   // value must not be kept beyond the call
+   template <typename KeyLike, typename Fun>
+   bool Visit(const KeyLike &key, Fun &&fun) {
+     std::lock_guard<std::mutex> lock(mutex_);
+
+     Handle handle = entries_.Find(key);
+     if (handle == EntryIndex::INVALID_HANDLE) {
+       return false;
+     }
+
+     // move item to front
+     entries_.MoveToFront(handle);
+     fun(static_cast<const V &>(entries_.ValueOf(handle)));
+     return true;
+   }
+
+   // the old value of |key| is destroyed if exists
+   void Put(K key, V value) {
+     std::lock_guard<std::mutex> lock(mutex_);
+
+     long size = size_fn_(key, value);
+
+     Handle handle = entries_.Find(key);
+     if (handle != EntryIndex::INVALID_HANDLE) {
+       V &old_value = entries_.ValueOf(handle);
+       cur_cache_size_ -= size_fn_(key, old_value);
+       old_value = std::move(value);
+       entries_.MoveToFront(handle);
+
+     } else {
+       entries_.PushFront(std::move(key), std::move(value));
+     }
+
+     cur_cache_size_ += size;
+
+     EvictIfNeeded();
+   }
+
+   template <typename KeyLike>
+   bool Remove(const KeyLike &key) {
+     std::lock_guard<std::mutex> lock(mutex_);
+
+     Handle handle = entries_.Find(key);
+     if (handle == EntryIndex::INVALID_HANDLE) {
+       return false;
+     }
+
+     RemoveInternal(handle);
+     return true;
+   }
+
+   void EvictAll() {
+     std::lock_guard<std::mutex> lock(mutex_);
+     entries_.Clear();
+     cur_cache_size_ = 0;
+     evicting_ = false;
+   }
+
+   long ItemCount() const {
+     std::lock_guard<std::mutex> lock(mutex_);
+     return entries_.Size();
+   }
+
+   long MaxItemCount() const {
+     return max_item_count_;
+   }
+
+   long CurrentCacheSize() const {
+     std::lock_guard<std::mutex> lock(mutex_);
+     return cur_cache_size_;
+   }
+
+   long MaxCacheSize() const {
+     return max_cache_size_;
+   }
+
+ private:
+   using EntryIndex = LruIndex<K, V, Hash>;
+   using Handle = typename EntryIndex::Handle;
+
+   // entries a Put() evicts at most between the watermarks
+   static const std::size_t EVICTION_BATCH_SIZE = 16;
+
+   // same as MemoryCache, once the cache size or the item count exceeds
+   // the high watermark of its limit, every Put() evicts a small batch of
+   // entries until both are below the low watermark of their limits, and
+   // as many more as it takes to stay within the limits
+   void EvictIfNeeded() {
+     if (!evicting_) {
+       if (cur_cache_size_ <= max_cache_size_ * eviction_high_watermark_ &&
+           static_cast<long>(entries_.Size()) <=
+           max_item_count_ * eviction_high_watermark_) {
+         return;
+       }
+       evicting_ = true;
+     }
+
+     std::size_t evicted = 0;
+     while (!entries_.Empty() && (cur_cache_size_ > max_cache_size_ ||
+           static_cast<long>(entries_.Size()) > max_item_count_ ||
+           (evicted < EVICTION_BATCH_SIZE && IsOverTarget()))) {
+       RemoveInternal(entries_.Back());
+       ++evicted;
+     }
+
+     if (!IsOverTarget()) {
+       evicting_ = false;
+     }
+   }
+
+   bool IsOverTarget() const {
+     return cur_cache_size_ > max_cache_size_ * eviction_low_watermark_ ||
+       static_cast<long>(entries_.Size()) >
+       max_item_count_ * eviction_low_watermark_;
+   }
+
+   void RemoveInternal(Handle handle) {
+     cur_cache_size_ -= size_fn_(entries_.KeyOf(handle),
+         entries_.ValueOf(handle));
+     entries_.Erase(handle);
+   }
+
+ private:
+   // most recently used entries first
+   EntryIndex entries_;
+
+   long max_cache_size_;
+   long max_item_count_;
+   long cur_cache_size_;
+   float eviction_high_watermark_;
+   float eviction_low_watermark_;
+   // set from crossing the high watermark to getting below the low one
+   bool evicting_;
+   SizeFn size_fn_;
+
+   mutable std::mutex mutex_;
+};
+
+};  // namespace lru
+
+#endif /* end of include guard: TYPED_MEMORY_CACHE_H_ */
@@ -0,0 +1,1059 @@
+#include "lru/disk_cache.h"
+#include "lru/journal.h"
+#include "lru/key_hasher.h"
+#include "lru/lru_index.h"
+#include "common/sha1/sha1.h"
+#include <malloc.h>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+namespace {
+  const char *BENCH_DIR = "bench_cache";
+  const int APP_VERSION = 100;
+
+  using Clock = std::chrono::steady_clock;
+
+  double ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count();
+  }
+
+  std::string Sha1KeyOf(long n) {
+    unsigned char sha1_hash[20];
+    std::string key(std::to_string(n));
+    sha1::calc(key.c_str(), key.size(), sha1_hash);
+    return std::string(reinterpret_cast<char *>(sha1_hash), sizeof(sha1_hash));
+  }
+
+  void ResetDir(const std::string &dir) {
+    std::string cmd("rm -rf " + dir + " && mkdir -p " + dir);
+    if (std::system(cmd.c_str()) != 0) {
+      fprintf(stderr, "failed to reset %s\n", dir.c_str());
+      std::exit(1);
+    }
+  }
+
+  long DiskUsageKb(const std::string &dir) {
+    std::string cmd("du -sk " + dir);
+    FILE *fp = ::popen(cmd.c_str(), "r");
+    long kb = -1;
+    if (fp) {
+      if (fscanf(fp, "%ld", &kb) != 1) {
+        kb = -1;
+      }
+      ::pclose(fp);
+    }
+    return kb;
+  }
+
+  bool WriteAll(int fd, const char *buf, long len) {
+    while (len > 0) {
+      ssize_t n = ::write(fd, buf, len);
+      if (n <= 0) {
+        return false;
+      }
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  // a TCP connection over loopback whose receiving end drains everything
+  // on a thread of its own
+  class LoopbackSink {
+   public:
+     LoopbackSink() : send_fd_(-1), received_(0) {
+       int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+       sockaddr_in addr;
+       std::memset(&addr, 0, sizeof(addr));
+       addr.sin_family = AF_INET;
+       addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+       socklen_t addr_len = sizeof(addr);
+       if (::bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+           ::listen(listen_fd, 1) != 0 ||
+           ::getsockname(listen_fd, (sockaddr *)&addr, &addr_len) != 0) {
+         fprintf(stderr, "failed to listen on loopback\n");
+         std::exit(1);
+       }
+
+       send_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+       if (::connect(send_fd_, (sockaddr *)&addr, sizeof(addr)) != 0) {
+         fprintf(stderr, "failed to connect to loopback\n");
+         std::exit(1);
+       }
+       int recv_fd = ::accept(listen_fd, nullptr, nullptr);
+       ::close(listen_fd);
+
+       reader_ = std::thread([this, recv_fd]{
+         char buf[256 * 1024];
+         ssize_t n;
+         while ((n = ::read(recv_fd, buf, sizeof(buf))) > 0) {
+           received_ += n;
+         }
+         ::close(recv_fd);
+       });
+     }
+
+     ~LoopbackSink() {
+       ::close(send_fd_);
+       reader_.join();
+     }
+
+     int SendFd() const {
+       return send_fd_;
+     }
+
+     void WaitFor(long bytes) const {
+       while (received_ < bytes) {
+         std::this_thread::yield();
+       }
+     }
+
+   private:
+     int send_fd_;
+     std::atomic<long> received_;
+     std::thread reader_;
+  };
+};
+
+// writes a journal of |record_count| records over record_count / 2 keys,
+// 70% updates, 25% reads and 5% deletes, then measures how long replaying
+// it takes, both for the bare journal scan and for a DiskCache to become
+// initialized from it. the page cache is warm in both cases.
+void bench_journal_replay(long record_count) {
+  std::string dir(std::string(BENCH_DIR) + "/replay");
+  ResetDir(dir);
+
+  long key_count = record_count / 2;
+  std::vector<std::string> keys;
+  keys.reserve(key_count);
+  for (long i = 0; i < key_count; ++i) {
+    keys.push_back(Sha1KeyOf(i));
+  }
+
+  lru::Journal journal(dir + "/journal", APP_VERSION,
+      lru::SHA1_KEY_HASHER.name);
+  journal.BeginRewrite();
+
+  unsigned long seed = 42;
+  for (long i = 0; i < record_count; ++i) {
+    seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+    const std::string &sha1_key = keys[(seed >> 33) % key_count];
+    int dice = (seed >> 20) % 100;
+    if (dice < 70) {
+      journal.Rewrite(lru::Journal::ACTION_UPDATE, sha1_key, dice * 97);
+    } else if (dice < 95) {
+      journal.Rewrite(lru::Journal::ACTION_READ, sha1_key, 0);
+    } else {
+      journal.Rewrite(lru::Journal::ACTION_DELETE, sha1_key, 0);
+    }
+  }
+  journal.CommitRewrite();
+  journal.Close();
+
+  long replayed = 0;
+  bool needs_rewrite = false;
+  auto start = Clock::now();
+  journal.Replay([&replayed](char action, const std::string &sha1_key,
+        long size, int segment, long offset) {
+      ++replayed;
+    }, &needs_rewrite);
+  double scan_ms = ElapsedMs(start);
+
+  start = Clock::now();
+  {
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30);
+    while (!cache.IsInitialized()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double init_ms = ElapsedMs(start);
+
+    double millions = record_count / 1e6;
+    printf("replay: %ld records, %ld entries\n", replayed, cache.ItemCount());
+    printf("  journal scan:  %8.2f ms, %8.2f ms per 1M records\n",
+        scan_ms, scan_ms / millions);
+    printf("  cache startup: %8.2f ms, %8.2f ms per 1M records "
+        "(includes compaction)\n", init_ms, init_ms / millions);
+  }
+}
+
+// streams cached entries of |file_size| bytes into a loopback socket, once
+// through Get() with an ifstream and a user space buffer, once through
+// GetToFd() with sendfile(2)
+void bench_get_to_fd(long file_size, int iterations) {
+  const int key_count = 16;
+  std::string dir(std::string(BENCH_DIR) + "/sendfile");
+  ResetDir(dir);
+
+  lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30);
+  std::string value(file_size, 'x');
+  for (int i = 0; i < key_count; ++i) {
+    cache.Put(std::to_string(i), [&value](std::ofstream &of) {
+      of.write(value.data(), value.size());
+      return true;
+    });
+  }
+
+  LoopbackSink sink;
+  long expected = 0;
+  double total_mb = (double)file_size * iterations / (1024 * 1024);
+
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    cache.Get(std::to_string(i % key_count), [&sink](std::ifstream &fin) {
+      char buf[64 * 1024];
+      while (fin.good()) {
+        fin.read(buf, sizeof(buf));
+        if (fin.gcount() <= 0 ||
+            !WriteAll(sink.SendFd(), buf, fin.gcount())) {
+          break;
+        }
+      }
+      return true;
+    });
+  }
+  expected += file_size * iterations;
+  sink.WaitFor(expected);
+  double ifstream_ms = ElapsedMs(start);
+
+  start = Clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    cache.GetToFd(std::to_string(i % key_count), sink.SendFd());
+  }
+  expected += file_size * iterations;
+  sink.WaitFor(expected);
+  double sendfile_ms = ElapsedMs(start);
+
+  printf("get to socket: %d x %ld bytes\n", iterations, file_size);
+  printf("  ifstream: %8.2f ms, %8.1f MB/s\n", ifstream_ms,
+      total_mb * 1000 / ifstream_ms);
+  printf("  sendfile: %8.2f ms, %8.1f MB/s\n", sendfile_ms,
+      total_mb * 1000 / sendfile_ms);
+}
+
+// writes |count| entries of |value_size| bytes over distinct keys, once
+// through the ofstream callback Put(), once through the buffer Put() and
+// once through the buffer Put() into segment files
+void bench_small_put(long value_size, long count) {
+  std::string value(value_size, 'x');
+  double ms[3];
+  long kb[3];
+
+  for (int round = 0; round < 3; ++round) {
+    std::string dir(std::string(BENCH_DIR) + "/put");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    if (round == 2) {
+      options.packed_max_size = value_size;
+    }
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+    auto start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      if (round == 0) {
+        cache.Put(std::to_string(i), [&value](std::ofstream &of) {
+          of.write(value.data(), value.size());
+          return true;
+        });
+      } else {
+        cache.Put(std::to_string(i), value.data(), value.size());
+      }
+    }
+    ms[round] = ElapsedMs(start);
+    kb[round] = DiskUsageKb(dir);
+  }
+
+  printf("small put: %ld x %ld bytes\n", count, value_size);
+  const char *names[] = { "ofstream:", "buffer:", "packed:" };
+  for (int round = 0; round < 3; ++round) {
+    printf("  %-9s %8.2f ms, %8.0f ops/s, %8ld KB on disk\n", names[round],
+        ms[round], count * 1000 / ms[round], kb[round]);
+  }
+}
+
+// puts |count| packed values then reads them all back, and measures how
+// long it takes until the background threads have journaled everything,
+// for a few journal flush policies
+void bench_journal_flush(long count) {
+  struct Round {
+    const char *name;
+    std::size_t max_buffered_bytes;
+    lru::Journal::SyncPolicy sync;
+  } rounds[] = {
+    { "per-record:", 0, lru::Journal::SYNC_NONE },
+    { "batched:", 64 * 1024, lru::Journal::SYNC_NONE },
+    { "batched+sync:", 64 * 1024, lru::Journal::SYNC_PER_FLUSH },
+    { "periodic:", 64 * 1024, lru::Journal::SYNC_PERIODIC },
+  };
+
+  std::string value(100, 'x');
+  printf("journal flush: %ld puts + %ld gets\n", count, count);
+
+  for (auto &round : rounds) {
+    std::string dir(std::string(BENCH_DIR) + "/journal");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.packed_max_size = value.size();
+    options.journal_flush.max_buffered_bytes = round.max_buffered_bytes;
+    options.journal_flush.sync = round.sync;
+
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+    while (!cache.IsInitialized()) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    auto start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      cache.Put(std::to_string(i), value.data(), value.size());
+    }
+    for (long i = 0; i < count; ++i) {
+      cache.GetStream(std::to_string(i), [](std::istream &fin) {
+        return true;
+      });
+    }
+
+    // every Put and Get writes one record
+    lru::Journal::Stats stats;
+    while ((stats = cache.JournalStats()).record_count < count * 2) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    double ms = ElapsedMs(start);
+
+    printf("  %-13s %8.2f ms, %8.0f ops/s, %6.1f records/flush, "
+        "%ld syncs\n", round.name, ms, count * 2 * 1000 / ms,
+        stats.flush_count ? (double)stats.record_count / stats.flush_count
+        : 0.0, stats.sync_count);
+  }
+}
+
+// reads |count| times from 10000 packed entries with a skewed distribution,
+// journaling every read and only the first read per key per epoch
+void bench_read_journal(long count) {
+  const long key_count = 10000;
+  const int epochs_ms[] = { 0, 1000 };
+  std::string value(100, 'x');
+  printf("read journal: %ld gets over %ld keys\n", count, key_count);
+
+  for (int epoch_ms : epochs_ms) {
+    std::string dir(std::string(BENCH_DIR) + "/read_journal");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.packed_max_size = value.size();
+    options.read_journal_epoch_ms = epoch_ms;
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+    for (long i = 0; i < key_count; ++i) {
+      cache.Put(std::to_string(i), value.data(), value.size());
+    }
+    while (cache.JournalStats().record_count < key_count) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    unsigned long seed = 42;
+    auto start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+      // squaring a uniform number favors the small keys
+      double r = (double)(seed >> 11) / (1UL << 53);
+      long key = (long)(r * r * key_count);
+      cache.GetStream(std::to_string(key), [](std::istream &fin) {
+        return true;
+      });
+    }
+    double ms = ElapsedMs(start);
+
+    // gives the background thread time to write what is left
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    long records = cache.JournalStats().record_count - key_count;
+
+    printf("  epoch %4d ms: %8.2f ms, %8.0f ops/s, %8ld read records "
+        "(%.3f per get)\n", epoch_ms, ms, count * 1000 / ms, records,
+        (double)records / count);
+  }
+}
+
+// measures the latency of Gets over |key_count| packed entries while every
+// 2000 journaled reads trigger a journal compaction, and again with read
+// epochs, where the journal is hardly ever compacted
+void bench_get_latency_during_compaction(long key_count, long count) {
+  const int epochs_ms[] = { 0, 1000000 };
+  std::string value(100, 'x');
+  printf("get latency: %ld gets over %ld keys\n", count, key_count);
+
+  for (int epoch_ms : epochs_ms) {
+    std::string dir(std::string(BENCH_DIR) + "/compaction");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.packed_max_size = value.size();
+    options.read_journal_epoch_ms = epoch_ms;
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+    for (long i = 0; i < key_count; ++i) {
+      cache.Put(std::to_string(i), value.data(), value.size());
+    }
+    while (cache.JournalStats().record_count < key_count) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    unsigned long seed = 42;
+    for (long i = 0; i < count; ++i) {
+      seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+      std::string key(std::to_string((seed >> 33) % key_count));
+
+      auto start = Clock::now();
+      cache.GetStream(key, [](std::istream &fin) {
+        return true;
+      });
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+            Clock::now() - start).count());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("  %-12s p50 %7.1f us, p99 %7.1f us, p99.9 %8.1f us, "
+        "max %8.1f us, %ld compactions\n",
+        epoch_ms == 0 ? "compacting:" : "idle:", latencies[count / 2],
+        latencies[count * 99 / 100], latencies[count * 999 / 1000],
+        latencies.back(), cache.JournalStats().rewrite_count);
+  }
+}
+
+// latency of Gets of a few hot keys while another thread keeps putting new
+// keys, each to a file of its own, into a full cache, evicting down to 75%
+// in a single batch against batches of 1ms down to 95%. the utilization is
+// the average item count seen by the Gets against the limit
+void bench_eviction_latency(long capacity, long count) {
+  const struct {
+    const char *name;
+    float low_watermark;
+    int batch_us;
+  } configs[] = {
+    { "bulk 75%:", 0.75f, 0 },
+    { "batches 95%:", 0.95f, 1000 },
+  };
+  std::string value(1024, 'x');
+  printf("eviction latency: %ld gets, capacity %ld\n", count, capacity);
+
+  for (auto &config : configs) {
+    std::string dir(std::string(BENCH_DIR) + "/eviction");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.eviction_low_watermark = config.low_watermark;
+    options.eviction_batch_us = config.batch_us;
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, capacity, options);
+    for (long i = 0; i < capacity; ++i) {
+      cache.Put(std::to_string(i), value.data(), value.size());
+    }
+
+    std::atomic<bool> stop(false);
+    std::thread writer([&cache, &value, &stop, capacity]{
+      for (long i = capacity; !stop; ++i) {
+        cache.Put(std::to_string(i), value.data(), value.size());
+      }
+    });
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    double item_count = 0;
+    for (long i = 0; i < count; ++i) {
+      auto start = Clock::now();
+      cache.Get("hot" + std::to_string(i % 100), [](std::ifstream &fin) {
+        return true;
+      });
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+            Clock::now() - start).count());
+
+      if (i < 100) {
+        cache.Put("hot" + std::to_string(i), value.data(), value.size());
+      }
+      item_count += cache.ItemCount();
+    }
+
+    stop = true;
+    writer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("  %-13s p50 %7.1f us, p99 %7.1f us, p99.9 %8.1f us, "
+        "max %8.1f us, utilization %5.1f%%\n", config.name,
+        latencies[count / 2], latencies[count * 99 / 100],
+        latencies[count * 999 / 1000], latencies.back(),
+        item_count * 100 / count / capacity);
+  }
+}
+
+// gets |key_count| keys of |value_size| bytes, in batches of 1 to 256
+// keys, one by one with Get() against GetBatch() without and with 4 I/O
+// threads, and puts them the same way. the data is in the page cache
+void bench_batch(long value_size, long key_count) {
+  const int io_thread_counts[] = { 0, 4 };
+  std::string value(value_size, 'x');
+  printf("batch: %ld keys of %ld bytes, keys/s\n", key_count, value_size);
+
+  std::vector<std::string> keys;
+  for (long i = 0; i < key_count; ++i) {
+    keys.push_back("tile-" + std::to_string(i));
+  }
+
+  printf("  %5s %10s %10s %10s %10s %10s %10s\n", "batch", "Get",
+      "GetBatch", "4 threads", "Put", "PutBatch", "4 threads");
+  for (std::size_t batch_size = 1; batch_size <= 256; batch_size *= 4) {
+    double rates[6];
+    for (int i = 0; i < 3; ++i) {
+      std::string dir(std::string(BENCH_DIR) + "/batch");
+      ResetDir(dir);
+
+      lru::DiskCache::Options options;
+      options.io_thread_count = io_thread_counts[i == 2 ? 1 : 0];
+      lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+
+      std::vector<std::pair<std::string, std::string>> entries;
+      auto start = Clock::now();
+      for (long k = 0; k < key_count; k += batch_size) {
+        long end = std::min<long>(k + batch_size, key_count);
+        if (i == 0) {
+          for (long j = k; j < end; ++j) {
+            cache.Put(keys[j], value.data(), value.size());
+          }
+        } else {
+          entries.clear();
+          for (long j = k; j < end; ++j) {
+            entries.emplace_back(keys[j], value);
+          }
+          cache.PutBatch(entries);
+        }
+      }
+      rates[3 + i] = key_count * 1000 / ElapsedMs(start);
+
+      std::vector<std::string> batch_keys;
+      std::vector<std::string> values;
+      std::string data;
+      long found = 0;
+      start = Clock::now();
+      for (long k = 0; k < key_count; k += batch_size) {
+        long end = std::min<long>(k + batch_size, key_count);
+        if (i == 0) {
+          for (long j = k; j < end; ++j) {
+            found += cache.Get(keys[j], [&data](std::ifstream &fin) {
+              data.assign(std::istreambuf_iterator<char>(fin),
+                  std::istreambuf_iterator<char>());
+              return true;
+            });
+          }
+        } else {
+          batch_keys.assign(keys.begin() + k, keys.begin() + end);
+          for (bool hit : cache.GetBatch(batch_keys, &values)) {
+            found += hit;
+          }
+        }
+      }
+      rates[i] = key_count * 1000 / ElapsedMs(start);
+
+      if (found != key_count) {
+        fprintf(stderr, "found %ld of %ld keys\n", found, key_count);
+        std::exit(1);
+      }
+    }
+
+    printf("  %5zu %10.0f %10.0f %10.0f %10.0f %10.0f %10.0f\n", batch_size,
+        rates[0], rates[1], rates[2], rates[3], rates[4], rates[5]);
+  }
+}
+
+// all the keys put and then got with Put() and Get(), and with PutAsync()
+// and GetAsync() through io_uring and through 4 threads, every async pass
+// submits everything before waiting
+void bench_async(long value_size, long key_count) {
+  const char *names[] = { "sync", "io_uring", "4 threads" };
+  std::string value(value_size, 'x');
+  printf("async: %ld keys of %ld bytes, keys/s\n", key_count, value_size);
+  printf("  %10s %10s %10s\n", "", "Put", "Get");
+
+  std::vector<std::string> keys;
+  for (long i = 0; i < key_count; ++i) {
+    keys.push_back("tile-" + std::to_string(i));
+  }
+
+  for (int i = 0; i < 3; ++i) {
+    std::string dir(std::string(BENCH_DIR) + "/async");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.use_io_uring = i == 1;
+    options.io_thread_count = 4;
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, 1L << 30, options);
+    if (i == 1 && !cache.UsesIoUring()) {
+      printf("  %10s %10s %10s\n", names[i], "-", "-");
+      continue;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    long pending = key_count;
+    long done_count = 0;
+    auto done = [&mutex, &cond, &pending, &done_count](bool ok) {
+      std::lock_guard<std::mutex> lock(mutex);
+      done_count += ok;
+      if (--pending == 0) {
+        cond.notify_one();
+      }
+    };
+    auto wait = [&mutex, &cond, &pending]{
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [&pending]{ return pending == 0; });
+    };
+
+    auto start = Clock::now();
+    for (long k = 0; k < key_count; ++k) {
+      if (i == 0) {
+        done(cache.Put(keys[k], value.data(), value.size()));
+      } else {
+        cache.PutAsync(keys[k], value, done);
+      }
+    }
+    wait();
+    double put_rate = key_count * 1000 / ElapsedMs(start);
+
+    pending = key_count;
+    std::string data;
+    start = Clock::now();
+    for (long k = 0; k < key_count; ++k) {
+      if (i == 0) {
+        done(cache.Get(keys[k], [&data](std::ifstream &fin) {
+          data.assign(std::istreambuf_iterator<char>(fin),
+              std::istreambuf_iterator<char>());
+          return true;
+        }));
+      } else {
+        cache.GetAsync(keys[k], [&done](bool found, std::string &&) {
+          done(found);
+        });
+      }
+    }
+    wait();
+    double get_rate = key_count * 1000 / ElapsedMs(start);
+
+    if (done_count != key_count * 2) {
+      fprintf(stderr, "%ld of %ld keys put and got\n", done_count,
+          key_count * 2);
+      std::exit(1);
+    }
+
+    printf("  %10s %10.0f %10.0f\n", names[i], put_rate, get_rate);
+  }
+}
+
+// latency of Gets of a few hot keys while another thread keeps putting
+// files of |file_size| bytes into a cache with room for 16 of them, every
+// Put evicting one. the evicted files are deleted on the shard's thread,
+// under the shard lock, against being moved to the trash and deleted by an
+// unlink thread
+void bench_unlink_latency(long file_size, long count) {
+  const int thread_counts[] = { 0, 1 };
+  std::string value(file_size, 'x');
+  printf("unlink latency: %ld gets, %ld KB files\n", count, file_size / 1024);
+
+  for (int thread_count : thread_counts) {
+    std::string dir(std::string(BENCH_DIR) + "/unlink");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.unlink_thread_count = thread_count;
+    lru::DiskCache cache(dir, APP_VERSION, file_size * 16, 1L << 30,
+        options);
+    std::string hot_value(100, 'x');
+    for (long i = 0; i < 100; ++i) {
+      cache.Put("hot" + std::to_string(i), hot_value.data(),
+          hot_value.size());
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> put_count(0);
+    std::thread writer([&cache, &value, &stop, &put_count]{
+      for (long i = 0; !stop; ++i) {
+        cache.Put(std::to_string(i), value.data(), value.size());
+        ++put_count;
+      }
+    });
+
+    std::vector<double> latencies;
+    latencies.reserve(count);
+    auto bench_start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      auto start = Clock::now();
+      cache.Get("hot" + std::to_string(i % 100), [](std::ifstream &fin) {
+        return true;
+      });
+      latencies.push_back(std::chrono::duration<double, std::micro>(
+            Clock::now() - start).count());
+    }
+    double ms = ElapsedMs(bench_start);
+
+    stop = true;
+    writer.join();
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("  %d threads: p50 %7.1f us, p99 %7.1f us, p99.9 %8.1f us, "
+        "max %8.1f us, %6.1f puts/s\n", thread_count, latencies[count / 2],
+        latencies[count * 99 / 100], latencies[count * 999 / 1000],
+        latencies.back(), put_count * 1000 / ms);
+  }
+}
+
+namespace {
+  // the index entry of DiskCache, keyed by the raw SHA1
+  struct IndexEntry {
+    long size;
+    long offset;
+    int segment;
+    unsigned read_epoch;
+  };
+
+  struct Sha1Key {
+    char data[20];
+
+    bool operator==(const Sha1Key &other) const {
+      return std::memcmp(data, other.data, sizeof(data)) == 0;
+    }
+  };
+
+  struct Sha1KeyHash {
+    std::size_t operator()(const Sha1Key &key) const {
+      uint32_t hash;
+      std::memcpy(&hash, key.data + 4, sizeof(hash));
+      return hash;
+    }
+  };
+
+  Sha1Key ToSha1Key(const std::string &sha1_key) {
+    Sha1Key key;
+    std::memcpy(key.data, sha1_key.data(), sizeof(key.data));
+    return key;
+  }
+
+  // the std::map + std::list index both caches used before LruIndex, the
+  // key is stored in the map and again in the list
+  template <typename Value>
+  class MapListIndex {
+   public:
+     void Insert(const std::string &key, const Value &value) {
+       list_.emplace_front(key, value);
+       map_.emplace(key, list_.begin());
+     }
+
+     bool Touch(const std::string &key) {
+       auto iter = map_.find(key);
+       if (iter == map_.end()) {
+         return false;
+       }
+       list_.splice(list_.begin(), list_, iter->second);
+       return true;
+     }
+
+   private:
+     using Element = std::pair<std::string, Value>;
+     std::map<std::string, typename std::list<Element>::iterator> map_;
+     std::list<Element> list_;
+  };
+
+  template <typename Key, typename Value, typename Hash>
+  class HashIndex {
+   public:
+     void Insert(const Key &key, const Value &value) {
+       index_.PushFront(key, value);
+     }
+
+     bool Touch(const Key &key) {
+       auto handle = index_.Find(key);
+       if (handle == lru::LruIndex<Key, Value, Hash>::INVALID_HANDLE) {
+         return false;
+       }
+       index_.MoveToFront(handle);
+       return true;
+     }
+
+   private:
+     lru::LruIndex<Key, Value, Hash> index_;
+  };
+
+  // large blocks are mmapped by malloc and counted apart
+  long HeapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+#else
+    struct mallinfo info = mallinfo();
+#endif
+    return info.uordblks + info.hblkhd;
+  }
+
+  // inserts all |keys| and looks up as many random ones, promoting each hit
+  // the way a Get does, then prints the heap bytes per entry and the ns per
+  // lookup
+  template <typename Index, typename Key, typename Value>
+  void BenchIndex(const char *name, const std::vector<Key> &keys,
+      const Value &value) {
+    long heap_before = HeapBytes();
+    Index *index = new Index();
+    for (auto &key : keys) {
+      index->Insert(key, value);
+    }
+    long heap_bytes = HeapBytes() - heap_before;
+
+    long count = keys.size();
+    unsigned long seed = 42;
+    long hits = 0;
+    auto start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+      hits += index->Touch(keys[(seed >> 33) % count]);
+    }
+    double ms = ElapsedMs(start);
+    delete index;
+
+    printf("  %-16s %7.1f bytes/entry, %7.1f ns/lookup (%ld hits)\n", name,
+        (double)heap_bytes / count, ms * 1000000 / count, hits);
+  }
+};
+
+// compares the memory footprint and the lookup speed of the std::map +
+// std::list index with LruIndex, for the SHA1 keys of DiskCache and for
+// short string keys as MemoryCache gets them
+void bench_index(long key_count) {
+  printf("index: %ld keys\n", key_count);
+
+  std::vector<std::string> sha1_keys;
+  std::vector<Sha1Key> raw_sha1_keys;
+  std::vector<std::string> string_keys;
+  for (long i = 0; i < key_count; ++i) {
+    sha1_keys.push_back(Sha1KeyOf(i));
+    raw_sha1_keys.push_back(ToSha1Key(sha1_keys.back()));
+    string_keys.push_back("key-" + std::to_string(i));
+  }
+
+  IndexEntry entry = { 100, 0, -1, 0 };
+  BenchIndex<MapListIndex<IndexEntry>>("sha1, map+list:", sha1_keys, entry);
+  BenchIndex<HashIndex<Sha1Key, IndexEntry, Sha1KeyHash>>(
+      "sha1, LruIndex:", raw_sha1_keys, entry);
+
+  void *value = nullptr;
+  BenchIndex<MapListIndex<void *>>("string, map+list:", string_keys, value);
+  BenchIndex<HashIndex<std::string, void *, std::hash<std::string>>>(
+      "string, LruIndex:", string_keys, value);
+}
+
+// measures the key hashers of DiskCache on keys of |key_size| bytes, the
+// scalar SHA1 used before hashers were configurable is the baseline
+void bench_key_hashers(long key_size, long count) {
+  printf("key hashers: %ld keys of %ld bytes\n", count, key_size);
+
+  struct Hasher {
+    const char *name;
+    void (*hash)(const void *data, std::size_t len, unsigned char *digest);
+  };
+  const Hasher hashers[] = {
+    { "sha1 (scalar)", [](const void *data, std::size_t len,
+        unsigned char *digest) {
+      sha1::calc(data, static_cast<int>(len), digest);
+    } },
+    { lru::SHA1_KEY_HASHER.name, lru::SHA1_KEY_HASHER.hash },
+    { lru::MURMUR3_128_KEY_HASHER.name, lru::MURMUR3_128_KEY_HASHER.hash },
+  };
+
+  std::string key(key_size, 'k');
+  for (auto &hasher : hashers) {
+    unsigned char digest[lru::KeyHasher::MAX_DIGEST_SIZE];
+    unsigned checksum = 0;
+    auto start = Clock::now();
+    for (long i = 0; i < count; ++i) {
+      std::memcpy(&key[0], &i, std::min(sizeof(i), key.size()));
+      hasher.hash(key.data(), key.size(), digest);
+      checksum += digest[0];
+    }
+    double ms = ElapsedMs(start);
+
+    printf("  %-14s %7.1f ns/key (checksum %u)\n", hasher.name,
+        ms * 1000000 / count, checksum);
+  }
+}
+
+// |phase_count| phases of |phase_length| zipf 0.9 accesses over
+// |key_count| keys, each followed by a scan of |scan_length| keys that are
+// never accessed again
+std::vector<std::string> ScanTrace(long key_count, long phase_length,
+    long scan_length, int phase_count) {
+  std::vector<double> cdf(key_count);
+  double sum = 0;
+  for (long i = 0; i < key_count; ++i) {
+    sum += 1.0 / std::pow(i + 1, 0.9);
+    cdf[i] = sum;
+  }
+
+  std::srand(7);
+  std::vector<std::string> trace;
+  long scanned = 0;
+  for (int phase = 0; phase < phase_count; ++phase) {
+    for (long i = 0; i < phase_length; ++i) {
+      double u = static_cast<double>(std::rand()) / RAND_MAX * sum;
+      long key = std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+      trace.push_back("key-" + std::to_string(key));
+    }
+    for (long i = 0; i < scan_length; ++i) {
+      trace.push_back("scan-" + std::to_string(scanned++));
+    }
+  }
+  return trace;
+}
+
+// one key per line
+std::vector<std::string> LoadTrace(const char *file) {
+  std::vector<std::string> trace;
+  std::ifstream fin(file);
+  std::string key;
+  while (std::getline(fin, key)) {
+    if (!key.empty()) {
+      trace.push_back(key);
+    }
+  }
+  return trace;
+}
+
+// replays |trace| through a DiskCache holding |capacity| packed entries, a
+// miss puts the key, and compares the hit ratios of the eviction policies.
+// entries are evicted in the background, so the cache briefly holds more
+// than |capacity| entries now and then
+void bench_trace(const std::vector<std::string> &trace, long capacity) {
+  printf("trace: %zu accesses, capacity %ld\n", trace.size(), capacity);
+
+  const struct {
+    const char *name;
+    lru::EvictionPolicy policy;
+  } policies[] = {
+    { "LRU", lru::EvictionPolicy::LRU },
+    { "TINY_LFU", lru::EvictionPolicy::TINY_LFU },
+    { "SLRU", lru::EvictionPolicy::SLRU },
+    { "ARC", lru::EvictionPolicy::ARC },
+  };
+
+  std::string value(16, 'v');
+  for (auto &policy : policies) {
+    std::string dir(std::string(BENCH_DIR) + "/trace");
+    ResetDir(dir);
+
+    lru::DiskCache::Options options;
+    options.packed_max_size = value.size();
+    options.eviction_policy = policy.policy;
+    lru::DiskCache cache(dir, APP_VERSION, 1L << 40, capacity, options);
+
+    long hits = 0;
+    auto start = Clock::now();
+    for (auto &key : trace) {
+      if (cache.GetStream(key, [](std::istream &) { return true; })) {
+        ++hits;
+      } else {
+        cache.Put(key, value.data(), value.size());
+      }
+    }
+    double ms = ElapsedMs(start);
+
+    printf("  %-9s %6.2f%% hit, %6.1f us/access\n", policy.name,
+        hits * 100.0 / trace.size(), ms * 1000 / trace.size());
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  std::string mode(argc > 1 ? argv[1] : "all");
+
+  if (mode == "all" || mode == "replay") {
+    long record_count = argc > 2 ? std::atol(argv[2]) : 1000000;
+    bench_journal_replay(record_count);
+  }
+
+  if (mode == "all" || mode == "sendfile") {
+    bench_get_to_fd(4 * 1024, 20000);
+    bench_get_to_fd(64 * 1024, 5000);
+    bench_get_to_fd(1024 * 1024, 500);
+  }
+
+  if (mode == "all" || mode == "journal") {
+    long count = argc > 2 ? std::atol(argv[2]) : 100000;
+    bench_journal_flush(count);
+  }
+
+  if (mode == "all" || mode == "reads") {
+    long count = argc > 2 ? std::atol(argv[2]) : 200000;
+    bench_read_journal(count);
+  }
+
+  if (mode == "all" || mode == "compaction") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 200000;
+    bench_get_latency_during_compaction(key_count, 100000);
+  }
+
+  if (mode == "all" || mode == "eviction") {
+    long capacity = argc > 2 ? std::atol(argv[2]) : 20000;
+    bench_eviction_latency(capacity, 200000);
+  }
+
+  if (mode == "all" || mode == "unlink") {
+    long file_size = argc > 2 ? std::atol(argv[2]) * 1024 : 4 * 1024 * 1024;
+    bench_unlink_latency(file_size, 100000);
+  }
+
+  if (mode == "all" || mode == "batch") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 4096;
+    bench_batch(4096, key_count);
+  }
+
+  if (mode == "all" || mode == "async") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 2048;
+    bench_async(64 * 1024, key_count);
+  }
+
+  if (mode == "all" || mode == "index") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 1000000;
+    bench_index(key_count);
+  }
+
+  if (mode == "all" || mode == "hash") {
+    long count = argc > 2 ? std::atol(argv[2]) : 2000000;
+    bench_key_hashers(16, count);
+    bench_key_hashers(64, count);
+    bench_key_hashers(256, count / 4);
+  }
+
+  if (mode == "all" || mode == "put") {
+    long count = argc > 2 ? std::atol(argv[2]) : 20000;
+    bench_small_put(200, count);
+  }
+
+  if (mode == "all" || mode == "trace") {
+    // a trace file and the capacity, or the synthetic traces
+    if (argc > 2) {
+      long capacity = argc > 3 ? std::atol(argv[3]) : 2000;
+      bench_trace(LoadTrace(argv[2]), capacity);
+    } else {
+      bench_trace(ScanTrace(20000, 200000, 0, 1), 2000);
+      bench_trace(ScanTrace(20000, 10000, 4000, 20), 2000);
+    }
+  }
+
+  return 0;
+}
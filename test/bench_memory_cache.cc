@@ -0,0 +1,333 @@
+#include "lru/memory_cache.h"
+#include "lru/typed_memory_cache.h"
+#include "lru/concurrent_memory_cache.h"
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+
+  double ElapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+        Clock::now() - start).count();
+  }
+
+  // a xorshift generator per thread, rand() takes a lock of its own
+  inline uint64_t NextRandom(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+  }
+
+  // |thread_count| threads look up |gets_per_thread| random keys each, all
+  // of them in the cache, returns the total hits per second
+  template <typename Cache>
+  double RunReaders(Cache &cache, const std::vector<std::string> &keys,
+      int thread_count, long gets_per_thread) {
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::atomic<long> hits(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t]() {
+        uint64_t state = 0x9e3779b97f4a7c15ULL * (t + 1);
+        long thread_hits = 0;
+        long value;
+
+        ++ready;
+        while (!go.load()) {
+          std::this_thread::yield();
+        }
+
+        for (long i = 0; i < gets_per_thread; ++i) {
+          if (cache.Get(keys[NextRandom(&state) % keys.size()], &value)) {
+            ++thread_hits;
+          }
+        }
+        hits += thread_hits;
+      });
+    }
+
+    while (ready.load() < thread_count) {
+      std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go = true;
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    double ms = ElapsedMs(start);
+
+    if (hits.load() != thread_count * gets_per_thread) {
+      fprintf(stderr, "missed %ld of %ld keys\n",
+          thread_count * gets_per_thread - hits.load(),
+          thread_count * gets_per_thread);
+      std::exit(1);
+    }
+    return hits.load() * 1000.0 / ms;
+  }
+
+  // |count| indices of keys in [0, key_count) drawn from a zipf
+  // distribution with exponent |s|, index 0 being the most popular
+  std::vector<uint32_t> ZipfTrace(long key_count, double s, long count,
+      uint64_t seed) {
+    std::vector<double> cdf(key_count);
+    double sum = 0;
+    for (long i = 0; i < key_count; ++i) {
+      sum += 1.0 / std::pow(i + 1, s);
+      cdf[i] = sum;
+    }
+
+    std::vector<uint32_t> trace;
+    trace.reserve(count);
+    uint64_t state = seed;
+    for (long i = 0; i < count; ++i) {
+      double u = (NextRandom(&state) >> 11) * (1.0 / 9007199254740992.0) * sum;
+      trace.push_back(static_cast<uint32_t>(
+            std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin()));
+    }
+    return trace;
+  }
+
+  struct ReadThroughResult {
+    double ops_per_sec;
+    double hit_ratio;
+  };
+
+  // every thread replays the trace from an offset of its own, a miss puts
+  // the key as if it had been loaded from somewhere slower
+  template <typename Cache>
+  ReadThroughResult RunReadThrough(Cache &cache,
+      const std::vector<std::string> &keys, const std::vector<uint32_t> &trace,
+      int thread_count, long ops_per_thread) {
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::atomic<long> hits(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&, t]() {
+        std::size_t pos = trace.size() / thread_count * t;
+        long thread_hits = 0;
+        long value;
+
+        ++ready;
+        while (!go.load()) {
+          std::this_thread::yield();
+        }
+
+        for (long i = 0; i < ops_per_thread; ++i) {
+          const std::string &key = keys[trace[pos]];
+          if (++pos == trace.size()) {
+            pos = 0;
+          }
+          if (cache.Get(key, &value)) {
+            ++thread_hits;
+          } else {
+            cache.Put(key, 0);
+          }
+        }
+        hits += thread_hits;
+      });
+    }
+
+    while (ready.load() < thread_count) {
+      std::this_thread::yield();
+    }
+    auto start = Clock::now();
+    go = true;
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    double ms = ElapsedMs(start);
+
+    long ops = thread_count * ops_per_thread;
+    return ReadThroughResult{ ops * 1000.0 / ms,
+      static_cast<double>(hits.load()) / ops };
+  }
+};
+
+// scales the readers of a fully populated cache from 1 to 64 threads, the
+// single lock of TypedMemoryCache (the same as that of MemoryCache) against
+// ConcurrentMemoryCache with 16 and 64 segments. hits never evict, so what
+// is measured is the lookup, the promotion and the locking
+void bench_concurrent_readers(long key_count, long gets_per_thread) {
+  printf("readers: %ld keys, %ld gets per thread, %u hardware threads\n",
+      key_count, gets_per_thread, std::thread::hardware_concurrency());
+
+  std::vector<std::string> keys;
+  keys.reserve(key_count);
+  for (long i = 0; i < key_count; ++i) {
+    keys.push_back("key-" + std::to_string(i));
+  }
+
+  // segments get uneven shares of the keys, the limits leave room for that
+  // so that no key is evicted
+  long limit = key_count * 2;
+  lru::TypedMemoryCache<std::string, long> single(limit, limit);
+  lru::ConcurrentMemoryCache<std::string, long> striped16(limit, limit, 16);
+  lru::ConcurrentMemoryCache<std::string, long> striped64(limit, limit, 64);
+  for (long i = 0; i < key_count; ++i) {
+    single.Put(keys[i], i);
+    striped16.Put(keys[i], i);
+    striped64.Put(keys[i], i);
+  }
+
+  printf("  %7s %16s %16s %16s\n", "threads", "single lock",
+      "16 segments", "64 segments");
+  for (int thread_count = 1; thread_count <= 64; thread_count *= 2) {
+    double single_rate = RunReaders(single, keys, thread_count,
+        gets_per_thread);
+    double striped16_rate = RunReaders(striped16, keys, thread_count,
+        gets_per_thread);
+    double striped64_rate = RunReaders(striped64, keys, thread_count,
+        gets_per_thread);
+    printf("  %7d %12.2f M/s %12.2f M/s %12.2f M/s\n", thread_count,
+        single_rate / 1000000, striped16_rate / 1000000,
+        striped64_rate / 1000000);
+  }
+}
+
+// strict LRU against CLOCK, both striped over 16 segments, on a zipf
+// workload over |key_count| keys with room for a tenth of them, throughput
+// and hit ratio side by side. the caches are warmed up with one pass over
+// the trace first
+void bench_clock(long key_count, long ops_per_thread) {
+  long capacity = key_count / 10;
+  printf("clock: %ld keys, zipf 0.99, capacity %ld, %ld ops per thread, "
+      "%u hardware threads\n", key_count, capacity, ops_per_thread,
+      std::thread::hardware_concurrency());
+
+  std::vector<std::string> keys;
+  keys.reserve(key_count);
+  for (long i = 0; i < key_count; ++i) {
+    keys.push_back("key-" + std::to_string(i));
+  }
+  std::vector<uint32_t> trace = ZipfTrace(key_count, 0.99, 1 << 21, 42);
+
+  lru::ConcurrentMemoryCache<std::string, long> lru_cache(capacity, capacity);
+  lru::ConcurrentClockMemoryCache<std::string, long> clock_cache(capacity,
+      capacity);
+  RunReadThrough(lru_cache, keys, trace, 1, trace.size());
+  RunReadThrough(clock_cache, keys, trace, 1, trace.size());
+
+  printf("  %7s %22s %22s\n", "threads", "LRU", "CLOCK");
+  for (int thread_count = 1; thread_count <= 64; thread_count *= 2) {
+    ReadThroughResult lru_result = RunReadThrough(lru_cache, keys, trace,
+        thread_count, ops_per_thread);
+    ReadThroughResult clock_result = RunReadThrough(clock_cache, keys, trace,
+        thread_count, ops_per_thread);
+    printf("  %7d %8.2f M/s %6.2f%% hit %8.2f M/s %6.2f%% hit\n",
+        thread_count, lru_result.ops_per_sec / 1000000,
+        lru_result.hit_ratio * 100, clock_result.ops_per_sec / 1000000,
+        clock_result.hit_ratio * 100);
+  }
+}
+
+// |phase_count| phases of |phase_length| zipf 0.9 accesses over
+// |key_count| keys, each followed by a scan of |scan_length| keys that are
+// never accessed again, like a batch job walking through its input
+std::vector<std::string> ScanTrace(long key_count, long phase_length,
+    long scan_length, int phase_count) {
+  std::vector<uint32_t> zipf = ZipfTrace(key_count, 0.9,
+      phase_length * phase_count, 7);
+  std::vector<std::string> trace;
+  long scanned = 0;
+  for (int phase = 0; phase < phase_count; ++phase) {
+    for (long i = 0; i < phase_length; ++i) {
+      trace.push_back("key-" + std::to_string(zipf[phase * phase_length + i]));
+    }
+    for (long i = 0; i < scan_length; ++i) {
+      trace.push_back("scan-" + std::to_string(scanned++));
+    }
+  }
+  return trace;
+}
+
+// one key per line
+std::vector<std::string> LoadTrace(const char *file) {
+  std::vector<std::string> trace;
+  std::ifstream fin(file);
+  std::string key;
+  while (std::getline(fin, key)) {
+    if (!key.empty()) {
+      trace.push_back(key);
+    }
+  }
+  return trace;
+}
+
+// replays |trace| through MemoryCache holding |capacity| entries, a miss
+// puts the key, and compares the hit ratios of the eviction policies
+void bench_trace(const std::vector<std::string> &trace, long capacity) {
+  printf("trace: %zu accesses, capacity %ld\n", trace.size(), capacity);
+
+  const struct {
+    const char *name;
+    lru::EvictionPolicy policy;
+  } policies[] = {
+    { "LRU", lru::EvictionPolicy::LRU },
+    { "TINY_LFU", lru::EvictionPolicy::TINY_LFU },
+    { "SLRU", lru::EvictionPolicy::SLRU },
+    { "ARC", lru::EvictionPolicy::ARC },
+  };
+
+  static char value;
+  for (auto &policy : policies) {
+    lru::MemoryCache cache(capacity, capacity,
+        [](const std::string &, void *) { return 1; },
+        [](const std::string &, void *) { }, policy.policy);
+
+    long hits = 0;
+    auto start = Clock::now();
+    for (auto &key : trace) {
+      if (cache.Get(key)) {
+        ++hits;
+      } else {
+        cache.Put(key, &value);
+      }
+    }
+    double ms = ElapsedMs(start);
+
+    printf("  %-9s %6.2f%% hit, %6.1f ns/access\n", policy.name,
+        hits * 100.0 / trace.size(), ms * 1000000 / trace.size());
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  std::string mode(argc > 1 ? argv[1] : "all");
+
+  if (mode == "all" || mode == "readers") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 100000;
+    bench_concurrent_readers(key_count, 200000);
+  }
+
+  if (mode == "all" || mode == "clock") {
+    long key_count = argc > 2 ? std::atol(argv[2]) : 1000000;
+    bench_clock(key_count, 200000);
+  }
+
+  if (mode == "all" || mode == "trace") {
+    // a trace file and the capacity, or the synthetic traces
+    if (argc > 2) {
+      long capacity = argc > 3 ? std::atol(argv[3]) : 10000;
+      bench_trace(LoadTrace(argv[2]), capacity);
+    } else {
+      bench_trace(ScanTrace(100000, 1000000, 0, 1), 10000);
+      bench_trace(ScanTrace(100000, 20000, 20000, 50), 10000);
+    }
+  }
+
+  return 0;
+}
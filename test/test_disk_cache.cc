@@ -1,6 +1,39 @@
 #include "lru/disk_cache.h"
 #include "log/log.h"
+#include <cstdlib>
 #include <thread>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+namespace {
+  void ResetDir(const std::string &dir) {
+    std::string cmd("rm -rf " + dir);
+    if (std::system(cmd.c_str()) != 0) {
+      LOG_E("main", "failed to reset %s", dir.c_str());
+    }
+  }
+
+  bool Has(lru::DiskCache &cache, const std::string &key) {
+    return cache.GetStream(key, [](std::istream &) { return true; });
+  }
+
+  void WaitForInitialization(lru::DiskCache &cache) {
+    while (!cache.IsInitialized()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  // until the action thread has not journaled anything for a while
+  void WaitForJournalIdle(lru::DiskCache &cache) {
+    long record_count = -1;
+    while (record_count != cache.JournalStats().record_count) {
+      record_count = cache.JournalStats().record_count;
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+  }
+};
 
 void test_read_write_with_multithreads(lru::DiskCache &cache) {
   const int tc = 10;
@@ -14,13 +47,19 @@ void test_read_write_with_multithreads(lru::DiskCache &cache) {
       for (int i = 0; i < 3000; ++i) {
         int value = std::rand() % 10000;
 
-        if (std::rand() % 10000 < 5000) {
+        int dice = std::rand() % 10000;
+        if (dice < 2500) {
           cache.Put(std::to_string(value), [value](std::ofstream &of) {
             of << value; 
               LOG_V("main", "WRITE data: %d", value);
               return true;
             });
 
+        } else if (dice < 5000) {
+          std::string data(std::to_string(value));
+          cache.Put(std::to_string(value), data.data(), data.size());
+          LOG_V("main", "WRITE data: %d", value);
+
         } else {
           bool found = cache.Get(std::to_string(value), [value](std::ifstream &fin) {
             std::string data;
@@ -56,15 +95,420 @@ void test_read_write_with_multithreads(lru::DiskCache &cache) {
   LOG_D("main", "all threads exit.");
   LOG_D("main", "cache_size=%ld, item_count=%ld", 
       cache.CurrentCacheSize(), cache.ItemCount());
+
+  lru::Journal::Stats stats = cache.JournalStats();
+  LOG_D("main", "journal records=%ld, flushes=%ld, syncs=%ld",
+      stats.record_count, stats.flush_count, stats.sync_count);
+}
+
+void test_get_mapped(lru::DiskCache &cache) {
+  LOG_V("main", "start testing GetMapped...");
+
+  cache.Put("mapped_key", [](std::ofstream &of) {
+    of << "old value";
+    return true;
+  });
+
+  auto mapped = cache.GetMapped("mapped_key");
+  if (!mapped) {
+    LOG_E("main", "GetMapped failed");
+    return;
+  }
+
+  // the mapping must survive overwriting and removing the entry
+  std::string new_value("new value");
+  cache.Put("mapped_key", new_value.data(), new_value.size());
+  cache.Remove("mapped_key");
+
+  std::string data(mapped->Data(), mapped->Size());
+  LOG_D("main", "mapped data after overwrite and remove: %s (%s)",
+      data.c_str(), data == "old value" ? "OK" : "FAILED");
+  LOG_D("main", "GetMapped after remove: %s",
+      cache.GetMapped("mapped_key") ? "FAILED" : "OK");
+
+  cache.Put("mapped_key", new_value.data(), new_value.size());
+  mapped = cache.GetMapped("mapped_key");
+  data = mapped ? std::string(mapped->Data(), mapped->Size()) : "";
+  LOG_D("main", "GetMapped after put again: %s (%s)", data.c_str(),
+      data == new_value ? "OK" : "FAILED");
+}
+
+// 8 threads load the same missing key, which must be loaded once, and put
+// another key all at once, which must be written less than 8 times
+void test_coalescing(lru::DiskCache &cache) {
+  LOG_V("main", "start testing GetOrLoad and coalesced Puts...");
+
+  const int tc = 8;
+  std::atomic<int> load_count(0);
+  std::atomic<int> write_count(0);
+  std::atomic<int> mismatch_count(0);
+  cache.Remove("load_key");
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < tc; ++i) {
+    threads.emplace_back([&cache, &load_count, &write_count, &mismatch_count,
+        i]{
+      std::string data;
+      bool ok = cache.GetOrLoad("load_key", &data, [&load_count](
+            std::string *data) {
+        ++load_count;
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        *data = "loaded value";
+        return true;
+      });
+      if (!ok || data != "loaded value") {
+        ++mismatch_count;
+      }
+
+      cache.Put("coalesced_key", [&write_count, i](std::ofstream &of) {
+        ++write_count;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        of << "value " << i;
+        return true;
+      });
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  std::string data;
+  bool found = cache.Get("coalesced_key", [&data](std::ifstream &fin) {
+    std::getline(fin, data);
+    return true;
+  });
+  LOG_D("main", "GetOrLoad: %d loads, %d mismatches (%s)", load_count.load(),
+      mismatch_count.load(),
+      load_count == 1 && mismatch_count == 0 ? "OK" : "FAILED");
+  LOG_D("main", "coalesced Puts: %d writes of %d, got '%s' (%s)",
+      write_count.load(), tc, data.c_str(),
+      found && write_count < tc && data.compare(0, 6, "value ") == 0 ?
+      "OK" : "FAILED");
+}
+
+// puts 50 keys in a batch, gets them along with 10 missing ones, removes
+// every other one and gets them all again
+void test_batch(lru::DiskCache &cache) {
+  LOG_V("main", "start testing batches...");
+
+  std::vector<std::pair<std::string, std::string>> entries;
+  std::vector<std::string> keys;
+  for (int i = 0; i < 60; ++i) {
+    keys.push_back("batch_key" + std::to_string(i));
+    if (i < 50) {
+      // some small enough to be packed, some not
+      entries.emplace_back(keys.back(),
+          std::string(i % 2 ? 8 : 100, 'a' + i % 26));
+    }
+  }
+
+  std::vector<bool> put = cache.PutBatch(entries);
+  int put_count = 0;
+  for (bool ok : put) {
+    put_count += ok;
+  }
+
+  std::vector<std::string> values;
+  std::vector<bool> found = cache.GetBatch(keys, &values);
+  int mismatch_count = 0;
+  for (int i = 0; i < 60; ++i) {
+    if (found[i] != (i < 50) || (i < 50 && values[i] != entries[i].second)) {
+      ++mismatch_count;
+    }
+  }
+  LOG_D("main", "PutBatch: %d of 50 put, GetBatch: %d mismatches (%s)",
+      put_count, mismatch_count,
+      put_count == 50 && mismatch_count == 0 ? "OK" : "FAILED");
+
+  std::vector<std::string> removed;
+  for (int i = 0; i < 50; i += 2) {
+    removed.push_back(keys[i]);
+  }
+  cache.RemoveBatch(removed);
+
+  found = cache.GetBatch(keys, &values);
+  mismatch_count = 0;
+  for (int i = 0; i < 60; ++i) {
+    bool expected = i < 50 && i % 2 == 1;
+    if (found[i] != expected || (expected && values[i] != entries[i].second)) {
+      ++mismatch_count;
+    }
+  }
+  LOG_D("main", "GetBatch after RemoveBatch: %d mismatches (%s)",
+      mismatch_count, mismatch_count == 0 ? "OK" : "FAILED");
+
+  cache.RemoveBatch(keys);
+}
+
+// puts 20 keys asynchronously, waits for them and gets them along with 5
+// missing ones asynchronously
+void test_async(lru::DiskCache &cache) {
+  LOG_V("main", "start testing async I/O through %s...",
+      cache.UsesIoUring() ? "io_uring" : "threads");
+
+  std::mutex mutex;
+  std::condition_variable cond;
+  int pending = 0;
+  int put_count = 0;
+  int mismatch_count = 0;
+
+  std::vector<std::string> values;
+  for (int i = 0; i < 25; ++i) {
+    // small ones are packed if the cache packs, large ones take several
+    // writes if they come short
+    values.push_back(std::string(i % 3 ? 10 : 30000 + i, 'a' + i % 26));
+  }
+
+  pending = 20;
+  for (int i = 0; i < 20; ++i) {
+    cache.PutAsync("async_key" + std::to_string(i), values[i],
+        [&mutex, &cond, &pending, &put_count](bool ok) {
+          std::lock_guard<std::mutex> lock(mutex);
+          put_count += ok;
+          if (--pending == 0) {
+            cond.notify_one();
+          }
+        });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&pending]{ return pending == 0; });
+  }
+
+  pending = 25;
+  for (int i = 0; i < 25; ++i) {
+    cache.GetAsync("async_key" + std::to_string(i),
+        [&mutex, &cond, &pending, &mismatch_count, &values, i](bool found,
+          std::string &&data) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (found != (i < 20) || (found && data != values[i])) {
+            ++mismatch_count;
+          }
+          if (--pending == 0) {
+            cond.notify_one();
+          }
+        });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&pending]{ return pending == 0; });
+  }
+
+  LOG_D("main", "PutAsync: %d of 20 put, GetAsync: %d mismatches (%s)",
+      put_count, mismatch_count,
+      put_count == 20 && mismatch_count == 0 ? "OK" : "FAILED");
+
+  for (int i = 0; i < 20; ++i) {
+    cache.Remove("async_key" + std::to_string(i));
+  }
+}
+
+// with TINY_LFU, a hit on a candidate moves it to the main part, which the
+// journal compaction writes first. candidates are hit while the journal is
+// compacted in chunks, they must all be there after reopening the cache
+void test_candidates_during_compaction() {
+  LOG_V("main", "start testing hits on candidates during compaction...");
+
+  const std::string dir("path/to/lfu_compaction_cache");
+  ResetDir(dir);
+
+  lru::DiskCache::Options options;
+  options.eviction_policy = lru::EvictionPolicy::TINY_LFU;
+  options.packed_max_size = 64;
+  const long max_item_count = 12000;
+
+  long item_count;
+  const int candidate_count = 10000;
+  {
+    lru::DiskCache cache(dir, 100, 1L << 30, max_item_count, options);
+
+    // fills the main part and evicts once, so that the entries put from
+    // then on become candidates, then shrinks the main part
+    for (int i = 0; i <= max_item_count; ++i) {
+      cache.Put("m" + std::to_string(i), "main", 4);
+    }
+    while (cache.ItemCount() > max_item_count) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    for (int i = 300; i <= max_item_count; ++i) {
+      cache.Remove("m" + std::to_string(i));
+    }
+    for (int i = 0; i < candidate_count; ++i) {
+      cache.Put("c" + std::to_string(i), "candidate", 9);
+    }
+    WaitForJournalIdle(cache);
+
+    // the reads of the main part make the journal compact itself, the
+    // newest candidates are the last to be reached by the compaction
+    long rewrite_count = cache.JournalStats().rewrite_count;
+    for (int i = candidate_count - 1;
+        i >= 0 && cache.JournalStats().rewrite_count == rewrite_count;
+        --i) {
+      Has(cache, "m" + std::to_string(i % 300));
+      Has(cache, "c" + std::to_string(i));
+    }
+    WaitForJournalIdle(cache);
+    item_count = cache.ItemCount();
+  }
+
+  lru::DiskCache cache(dir, 100, 1L << 30, max_item_count, options);
+  int missing_count = 0;
+  for (int i = 0; i < candidate_count; ++i) {
+    missing_count += !Has(cache, "c" + std::to_string(i));
+  }
+  LOG_D("main", "candidates after reopening: %d missing, %ld of %ld "
+      "entries (%s)", missing_count, cache.ItemCount(), item_count,
+      missing_count == 0 && cache.ItemCount() == item_count ?
+      "OK" : "FAILED");
+}
+
+// keys are read, put and removed while the journal is rewritten in chunks,
+// reopening the cache must give the same entries back, in the same LRU
+// order, which is checked by evicting the entries that were not touched
+void test_mutations_during_compaction() {
+  LOG_V("main", "start testing mutations during compaction...");
+
+  const std::string dir("path/to/compaction_cache");
+  ResetDir(dir);
+
+  lru::DiskCache::Options options;
+  options.packed_max_size = 64;
+  options.eviction_batch_us = 0;
+  options.eviction_low_watermark = 1.0f;
+  const long max_item_count = 10000;
+  const int base_count = 6000;
+
+  int touched_count = 0;
+  bool compacted = false;
+  {
+    lru::DiskCache cache(dir, 100, 1L << 30, max_item_count, options);
+    for (int i = 0; i < base_count; ++i) {
+      cache.Put("k" + std::to_string(i), "base", 4);
+    }
+    WaitForJournalIdle(cache);
+
+    // the oldest keys are read and the newest removed, the reads and
+    // removes make the journal compact itself
+    long rewrite_count = cache.JournalStats().rewrite_count;
+    while (touched_count < base_count / 2 &&
+        !(compacted = cache.JournalStats().rewrite_count != rewrite_count)) {
+      std::string i = std::to_string(touched_count);
+      Has(cache, "k" + i);
+      cache.Put("n" + i, "new", 3);
+      cache.Remove("k" + std::to_string(base_count - 1 - touched_count));
+      ++touched_count;
+    }
+    WaitForJournalIdle(cache);
+  }
+
+  // reads the keys in the order they were last used before, so that the
+  // check does not change the LRU order
+  auto check = [touched_count](lru::DiskCache &cache, bool untouched) {
+    int mismatch_count = 0;
+    for (int i = touched_count; i < base_count; ++i) {
+      bool expected = untouched && i < base_count - touched_count;
+      mismatch_count += Has(cache, "k" + std::to_string(i)) != expected;
+    }
+    for (int i = 0; i < touched_count; ++i) {
+      mismatch_count += !Has(cache, "k" + std::to_string(i));
+      mismatch_count += !Has(cache, "n" + std::to_string(i));
+    }
+    return mismatch_count;
+  };
+
+  int index_mismatches;
+  long item_count;
+  {
+    lru::DiskCache cache(dir, 100, 1L << 30, max_item_count, options);
+    WaitForInitialization(cache);
+    item_count = cache.ItemCount();
+    index_mismatches = check(cache, true);
+  }
+
+  // the untouched keys are the least recently used, a limit leaving room
+  // for the touched ones only evicts them all and nothing else
+  lru::DiskCache cache(dir, 100, 1L << 30, 2 * touched_count, options);
+  WaitForInitialization(cache);
+  while (cache.ItemCount() > 2 * touched_count) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  int order_mismatches = check(cache, false);
+
+  LOG_D("main", "mutations during compaction: %d touched, %ld of %d "
+      "entries, %d index mismatches, %d order mismatches (%s)",
+      touched_count, item_count, base_count, index_mismatches,
+      order_mismatches, compacted && item_count == base_count &&
+      index_mismatches == 0 && order_mismatches == 0 ? "OK" : "FAILED");
 }
 
 int main(int argc, const char *argv[]) {
-  lru::DiskCache cache("path/to/cache", 100, 10240, 1000);
-  test_read_write_with_multithreads(cache);
+  {
+    lru::DiskCache cache("path/to/cache", 100, 10240, 1000);
+    test_read_write_with_multithreads(cache);
+    test_get_mapped(cache);
+    test_coalescing(cache);
+    test_batch(cache);
+  }
+
+  test_candidates_during_compaction();
+  test_mutations_during_compaction();
+
+  lru::DiskCache::Options options;
+  options.warm_start = true;
+  {
+    // reopen the cache above, requests are served during journal replay
+    lru::DiskCache cache("path/to/cache", 100, 10240, 1000, options);
+    test_read_write_with_multithreads(cache);
+  }
+
+  options.shard_count = 4;
+  options.read_journal_epoch_ms = 100;
+  options.key_hasher = lru::MURMUR3_128_KEY_HASHER;
+  options.eviction_policy = lru::EvictionPolicy::TINY_LFU;
+  lru::DiskCache sharded_cache("path/to/sharded_cache", 100, 10240, 1000,
+      options);
+  test_read_write_with_multithreads(sharded_cache);
+
+  // values of the buffer Put go to small segments, which get compacted often
+  lru::DiskCache::Options packed_options;
+  packed_options.shard_count = 2;
+  packed_options.packed_max_size = 16;
+  packed_options.segment_size = 4096;
+  packed_options.eviction_policy = lru::EvictionPolicy::ARC;
+  {
+    lru::DiskCache packed_cache("path/to/packed_cache", 100, 10240, 1000,
+        packed_options);
+    test_read_write_with_multithreads(packed_cache);
+    test_get_mapped(packed_cache);
+  }
+  {
+    // roomy enough for a batch not to be evicted, with reads and writes
+    // spread over threads
+    lru::DiskCache::Options batch_options(packed_options);
+    batch_options.shard_count = 4;
+    batch_options.io_thread_count = 2;
+    lru::DiskCache batch_cache("path/to/batch_cache", 100, 1 << 20, 1000,
+        batch_options);
+    test_batch(batch_cache);
+    test_async(batch_cache);
+  }
+  {
+    lru::DiskCache::Options async_options;
+    async_options.use_io_uring = false;
+    async_options.io_thread_count = 2;
+    lru::DiskCache async_cache("path/to/async_cache", 100, 1 << 24, 1000,
+        async_options);
+    test_async(async_cache);
+  }
+
+  packed_options.warm_start = true;
+  lru::DiskCache packed_cache("path/to/packed_cache", 100, 10240, 1000,
+      packed_options);
+  test_read_write_with_multithreads(packed_cache);
 
-  printf("\nExecute the following commands to check the result:\n");
-  printf("find path/to/cache -type f | fgrep -v journal | xargs ls -l | awk '{a+=$5}END{print a, NR}'\n");
-  printf("awk '/U/{a[$2]=$3; next} /D/{delete a[$2]}END{for(e in a){c+=a[e]} print c, length(a)}' path/to/cache/journal\n\n");
+  printf("\nExecute the following command and compare the result with the "
+      "cache_size and item_count logged above:\n");
+  printf("find path/to/cache -type f | fgrep -v journal | xargs ls -l | awk '{a+=$5}END{print a, NR}'\n\n");
   
   std::chrono::milliseconds dura(300);
   std::this_thread::sleep_for(dura);
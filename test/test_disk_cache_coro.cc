@@ -0,0 +1,95 @@
+#include "lru/disk_cache.h"
+#include "log/log.h"
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+
+namespace {
+  // starts running at once and frees itself when done
+  struct Task {
+    struct promise_type {
+      Task get_return_object() { return Task(); }
+      std::suspend_never initial_suspend() { return std::suspend_never(); }
+      std::suspend_never final_suspend() noexcept {
+        return std::suspend_never();
+      }
+      void return_void() { }
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  struct Counter {
+    std::mutex mutex;
+    std::condition_variable cond;
+    int pending = 0;
+    int mismatch_count = 0;
+
+    void Done(bool ok) {
+      std::lock_guard<std::mutex> lock(mutex);
+      mismatch_count += !ok;
+      if (--pending == 0) {
+        cond.notify_one();
+      }
+    }
+
+    void Wait() {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [this]{ return pending == 0; });
+    }
+  };
+
+  // puts a key, gets it back and gets a missing one
+  Task PutAndGet(lru::DiskCache &cache, int i, Counter &counter) {
+    std::string key("coro_key" + std::to_string(i));
+    std::string value(i % 4 ? 10 : 20000 + i, 'a' + i % 26);
+
+    bool put = co_await cache.PutAsync(key, value);
+    std::optional<std::string> data = co_await cache.GetAsync(key);
+    std::optional<std::string> missing =
+      co_await cache.GetAsync("missing" + key);
+
+    counter.Done(put && data && *data == value && !missing);
+  }
+};
+
+// 1000 coroutines in flight at once on the few threads of the cache
+void test_coroutines(lru::DiskCache &cache) {
+  LOG_V("main", "start testing coroutines through %s...",
+      cache.UsesIoUring() ? "io_uring" : "threads");
+
+  const int count = 1000;
+  Counter counter;
+  counter.pending = count;
+  for (int i = 0; i < count; ++i) {
+    PutAndGet(cache, i, counter);
+  }
+  counter.Wait();
+
+  LOG_D("main", "coroutines: %d of %d mismatched (%s)",
+      counter.mismatch_count, count,
+      counter.mismatch_count == 0 ? "OK" : "FAILED");
+
+  for (int i = 0; i < count; ++i) {
+    cache.Remove("coro_key" + std::to_string(i));
+  }
+}
+
+int main(int argc, const char *argv[]) {
+  lru::DiskCache::Options options;
+  options.packed_max_size = 16;
+  {
+    lru::DiskCache cache("path/to/coro_cache", 100, 1 << 26, 10000, options);
+    test_coroutines(cache);
+  }
+
+  options.use_io_uring = false;
+  options.io_thread_count = 2;
+  {
+    lru::DiskCache cache("path/to/coro_cache", 100, 1 << 26, 10000, options);
+    test_coroutines(cache);
+  }
+
+  return 0;
+}
@@ -1,9 +1,35 @@
 #include "lru/memory_cache.h"
+#include "lru/evictor.h"
 #include "log/log.h"
 #include <thread>
 #include <iostream>
 
+struct Slot {
+  unsigned char region;
+
+  Slot() : region(0) { }
+};
+
+// a list holding nothing but markers has nothing to evict, even if the
+// limits are still exceeded
+void test_evict_markers_only(lru::EvictionPolicy policy, const char *name) {
+  using Index = lru::LruIndex<std::string, Slot>;
+  Index index;
+  lru::Evictor<Index, std::hash<std::string>> evictor(&index, policy);
+  index.PushBackMarker(Slot());
+
+  int evicted = 0;
+  evictor.Evict([]{ return true; },
+      [&evicted](Index::Handle) { ++evicted; });
+  std::cout << name << " evicted " << evicted << " of markers only ("
+    << (evicted == 0 ? "OK" : "FAILED") << ")" << std::endl;
+}
+
 int main(int argc, const char *argv[]) {
+  test_evict_markers_only(lru::EvictionPolicy::LRU, "LRU");
+  test_evict_markers_only(lru::EvictionPolicy::TINY_LFU, "TINY_LFU");
+  test_evict_markers_only(lru::EvictionPolicy::SLRU, "SLRU");
+
   lru::MemoryCache cache(1024*5, 3, 
       [](const std::string &key, void *value){ 
         std::string *s = reinterpret_cast<std::string *>(value);
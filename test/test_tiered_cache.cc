@@ -0,0 +1,144 @@
+#include "lru/tiered_cache.h"
+#include "log/log.h"
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+  void Check(bool ok, const char *what) {
+    if (!ok) {
+      LOG_E("main", "FAILED: %s", what);
+      std::exit(1);
+    }
+  }
+
+  void LogStats(const lru::TieredCache &cache) {
+    lru::TieredCache::Stats stats = cache.GetStats();
+    LOG_D("main", "memory hits=%ld, disk hits=%ld, misses=%ld, "
+        "promotions=%ld, demotions=%ld, memory items=%ld",
+        stats.memory_hit_count, stats.disk_hit_count, stats.miss_count,
+        stats.promotion_count, stats.demotion_count, cache.MemoryItemCount());
+  }
+};
+
+// 100 keys through a memory tier with room for 10, then all of them again
+// with an empty memory tier
+void test_tiers(lru::DiskCache &disk, bool write_back) {
+  LOG_D("main", "start testing tiers, write_back=%d", write_back);
+
+  lru::TieredCache::Options options;
+  options.write_back = write_back;
+  std::string value;
+  {
+    lru::TieredCache cache(&disk, 1 << 20, 10, options);
+    for (int i = 0; i < 100; ++i) {
+      cache.Put("key-" + std::to_string(i), "value-" + std::to_string(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+      Check(cache.Get("key-" + std::to_string(i), &value) &&
+          value == "value-" + std::to_string(i), "get after put");
+    }
+
+    cache.Put("key-1", "new value");
+    Check(cache.Get("key-1", &value) && value == "new value",
+        "get after overwrite");
+    cache.Remove("key-0");
+    Check(!cache.Get("key-0", &value), "get after remove");
+    LogStats(cache);
+  }
+
+  lru::TieredCache cache(&disk, 1 << 20, 10, options);
+  Check(!cache.Get("key-0", &value), "removed key after reopening");
+  Check(cache.Get("key-1", &value) && value == "new value",
+      "overwritten key after reopening");
+  for (int i = 2; i < 100; ++i) {
+    Check(cache.Get("key-" + std::to_string(i), &value) &&
+        value == "value-" + std::to_string(i), "get after reopening");
+  }
+  Check(cache.GetStats().disk_hit_count == 99, "disk hits after reopening");
+  LogStats(cache);
+
+  for (int i = 0; i < 100; ++i) {
+    cache.Remove("key-" + std::to_string(i));
+  }
+}
+
+// every thread puts, gets and removes keys of its own, and remembers what
+// it did last to them, which must be what is found after reopening
+void test_read_write_with_multithreads(lru::DiskCache &disk, bool write_back) {
+  LOG_D("main", "start testing with threads, write_back=%d", write_back);
+
+  const int tc = 4;
+  const int keys_per_thread = 50;
+  std::vector<std::vector<std::string>> last_values(tc,
+      std::vector<std::string>(keys_per_thread));
+
+  lru::TieredCache::Options options;
+  options.write_back = write_back;
+  options.eviction_policy = lru::EvictionPolicy::TINY_LFU;
+  {
+    lru::TieredCache cache(&disk, 1 << 20, 20, options);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < tc; ++t) {
+      threads.emplace_back([&cache, &last_values, t]{
+        std::vector<std::string> &last = last_values[t];
+        std::string value;
+        for (int i = 0; i < 5000; ++i) {
+          int k = std::rand() % keys_per_thread;
+          std::string key("t" + std::to_string(t) + "-" + std::to_string(k));
+
+          switch (std::rand() % 4) {
+            case 0:
+              last[k] = key + "=" + std::to_string(i);
+              cache.Put(key, last[k]);
+              break;
+            case 1:
+              last[k].clear();
+              cache.Remove(key);
+              break;
+            default:
+              if (cache.Get(key, &value)) {
+                Check(value == last[k], "value seen by the writer");
+              } else {
+                Check(last[k].empty(), "missing value");
+              }
+          }
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    LogStats(cache);
+  }
+
+  lru::TieredCache cache(&disk, 1 << 20, 20, options);
+  std::string value;
+  for (int t = 0; t < tc; ++t) {
+    for (int k = 0; k < keys_per_thread; ++k) {
+      std::string key("t" + std::to_string(t) + "-" + std::to_string(k));
+      if (last_values[t][k].empty()) {
+        Check(!cache.Get(key, &value), "removed key after reopening");
+      } else {
+        Check(cache.Get(key, &value) && value == last_values[t][k],
+            "last value after reopening");
+      }
+      cache.Remove(key);
+    }
+  }
+  LogStats(cache);
+}
+
+int main(int argc, const char *argv[]) {
+  lru::DiskCache disk("path/to/tiered_cache", 100, 1 << 24, 10000);
+
+  test_tiers(disk, false);
+  test_tiers(disk, true);
+  test_read_write_with_multithreads(disk, false);
+  test_read_write_with_multithreads(disk, true);
+
+  LOG_D("main", "all passed");
+  return 0;
+}
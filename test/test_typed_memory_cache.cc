@@ -0,0 +1,95 @@
+#include "lru/typed_memory_cache.h"
+#include "lru/clock_memory_cache.h"
+#include "lru/concurrent_memory_cache.h"
+#include <memory>
+#include <iostream>
+
+struct StringSize {
+  std::size_t operator()(const std::string &key,
+      const std::string &value) const {
+    return value.size();
+  }
+};
+
+int main(int argc, const char *argv[]) {
+  lru::TypedMemoryCache<std::string, std::string, StringSize> cache(1024*5, 3);
+
+  cache.Put("a", "aaaaaaaaa");
+  cache.Put("b", "bbbbbbbbb");
+  cache.Put("c", "ccccccccc");
+  std::string value;
+  cache.Get("a", &value);
+  cache.Put("d", "ddddddddd");
+
+  if (cache.Get(std::string("b"), &value)) {
+    std::cout << "found: '" << value << "' for key: b" << std::endl;
+  } else {
+    std::cout << "not found for key " << "b" << std::endl;
+  }
+#if __cplusplus >= 201703L
+  // no key string is made for the lookup
+  if (cache.Get(std::string_view("a"), &value)) {
+    std::cout << "found: '" << value << "' for key: a" << std::endl;
+  }
+#endif
+  std::cout << "item count: " << cache.ItemCount() << std::endl;
+  std::cout << "cache size: " << cache.CurrentCacheSize() << std::endl;
+
+  cache.Remove(std::string("a"));
+
+  cache.EvictAll();
+
+  std::cout << "item count: " << cache.ItemCount() << std::endl;
+  std::cout << "cache size: " << cache.CurrentCacheSize() << std::endl;
+
+  // values shared with the caller stay alive after being evicted
+  lru::TypedMemoryCache<int, std::shared_ptr<std::string>> shared_cache(2, 2);
+  shared_cache.Put(1, std::make_shared<std::string>("one"));
+  std::shared_ptr<std::string> one;
+  shared_cache.Get(1, &one);
+  shared_cache.Put(2, std::make_shared<std::string>("two"));
+  shared_cache.Put(3, std::make_shared<std::string>("three"));
+  std::cout << "evicted value: " << *one << ", use count: " << one.use_count()
+    << std::endl;
+  shared_cache.Visit(3, [](const std::shared_ptr<std::string> &value) {
+    std::cout << "visited: " << *value << std::endl;
+  });
+  std::cout << "item count: " << shared_cache.ItemCount() << std::endl;
+
+  // "x" was read since it was put, it survives the eviction of "y" and "z"
+  // although it is the least recently put
+  lru::ClockMemoryCache<std::string, int> clock_cache(4, 4);
+  clock_cache.Put("x", 1);
+  clock_cache.Put("y", 2);
+  clock_cache.Put("z", 3);
+  int number;
+  clock_cache.Get("x", &number);
+  clock_cache.Put("w", 4);
+  clock_cache.Put("v", 5);
+  std::cout << "clock keeps x: " << clock_cache.Get("x", &number)
+    << ", y: " << clock_cache.Get("y", &number)
+    << ", item count: " << clock_cache.ItemCount() << std::endl;
+
+  // 101 items go over the limit, the Put() evicts a batch of 16 items, and
+  // so does every next one until the cache is down to the low watermark
+  // of 50 items, which leaves 85 and then 70
+  lru::TypedMemoryCache<int, int> batch_cache(100, 100, lru::UnitSize(),
+      1.0f, 0.5f);
+  for (int i = 0; i <= 100; ++i) {
+    batch_cache.Put(i, i);
+  }
+  long first_count = batch_cache.ItemCount();
+  batch_cache.Put(101, 101);
+  std::cout << "batch eviction item count: " << first_count
+    << ", after the next put: " << batch_cache.ItemCount() << std::endl;
+
+  // 3 items do not go around 16 segments, every segment keeps what is put
+  lru::ConcurrentMemoryCache<int, int> small_cache(3, 3, 16);
+  for (int i = 0; i < 3; ++i) {
+    small_cache.Put(i, i);
+  }
+  std::cout << "small cache segments: " << small_cache.SegmentCount()
+    << ", has 2: " << small_cache.Get(2, &number) << std::endl;
+
+  return 0;
+}